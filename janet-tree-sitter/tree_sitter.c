@@ -1,5 +1,13 @@
+// clock_gettime, mmap and friends are posix rather than c99
+#define _POSIX_C_SOURCE 200809L
+#if defined(__APPLE__)
+// keeps _SC_NPROCESSORS_ONLN visible alongside _POSIX_C_SOURCE
+#define _DARWIN_C_SOURCE
+#endif
+
 #include <janet.h>
 
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -58,6 +66,7 @@ struct TSParser {
 typedef HINSTANCE Clib;
 #define load_clib(name) LoadLibrary((name))
 #define symbol_clib(lib, sym) GetProcAddress((lib), (sym))
+#define close_clib(lib) FreeLibrary((lib))
 static char error_clib_buf[256];
 static char *error_clib(void) {
   FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
@@ -71,11 +80,205 @@ static char *error_clib(void) {
 typedef void *Clib;
 #define load_clib(name) dlopen((name), RTLD_NOW)
 #define symbol_clib(lib, sym) dlsym((lib), (sym))
+#define close_clib(lib) dlclose((lib))
 #define error_clib() dlerror()
 #endif
 
 ////////
 
+// lock used to guard process-wide state (e.g. the grammar registry)
+
+#if defined(WIN32) || defined(_WIN32)
+typedef SRWLOCK JTSMutex;
+#define JTS_MUTEX_INIT SRWLOCK_INIT
+#define jts_mutex_init(m) InitializeSRWLock((m))
+#define jts_mutex_destroy(m) ((void)(m))
+#define jts_mutex_lock(m) AcquireSRWLockExclusive((m))
+#define jts_mutex_unlock(m) ReleaseSRWLockExclusive((m))
+#else
+#include <pthread.h>
+typedef pthread_mutex_t JTSMutex;
+#define JTS_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#define jts_mutex_init(m) pthread_mutex_init((m), NULL)
+#define jts_mutex_destroy(m) pthread_mutex_destroy((m))
+#define jts_mutex_lock(m) pthread_mutex_lock((m))
+#define jts_mutex_unlock(m) pthread_mutex_unlock((m))
+#endif
+
+// native worker threads for batch operations
+
+#if defined(WIN32) || defined(_WIN32)
+typedef HANDLE JTSThread;
+typedef LPTHREAD_START_ROUTINE JTSThreadFn;
+#define JTS_THREAD_FN(name, arg) DWORD WINAPI name(LPVOID arg)
+#define JTS_THREAD_RESULT 0
+static int jts_thread_create(JTSThread *t, JTSThreadFn fn, void *arg) {
+  *t = CreateThread(NULL, 0, fn, arg, 0, NULL);
+  return (NULL == *t) ? -1 : 0;
+}
+static void jts_thread_join(JTSThread t) {
+  WaitForSingleObject(t, INFINITE);
+  CloseHandle(t);
+}
+static int32_t jts_cpu_count(void) {
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return (int32_t)info.dwNumberOfProcessors;
+}
+#else
+#include <unistd.h>
+typedef pthread_t JTSThread;
+typedef void *(*JTSThreadFn)(void *);
+#define JTS_THREAD_FN(name, arg) void *name(void *arg)
+#define JTS_THREAD_RESULT NULL
+static int jts_thread_create(JTSThread *t, JTSThreadFn fn, void *arg) {
+  return pthread_create(t, NULL, fn, arg);
+}
+static void jts_thread_join(JTSThread t) {
+  (void)pthread_join(t, NULL);
+}
+static int32_t jts_cpu_count(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n < 1) ? 1 : (int32_t)n;
+}
+#endif
+
+// atomics for state shared between janet threads
+
+#if defined(WIN32) || defined(_WIN32)
+#define jts_atomic_inc(p) InterlockedIncrement((volatile LONG *)(p))
+#define jts_atomic_dec(p) InterlockedDecrement((volatile LONG *)(p))
+#define jts_atomic_store_size(p, v) \
+  InterlockedExchangePointer((PVOID volatile *)(p), (PVOID)(size_t)(v))
+#define jts_atomic_load_size(p) \
+  ((size_t)InterlockedCompareExchangePointer((PVOID volatile *)(p), \
+                                             NULL, NULL))
+#else
+#define jts_atomic_inc(p) __atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+#define jts_atomic_dec(p) __atomic_sub_fetch((p), 1, __ATOMIC_ACQ_REL)
+#define jts_atomic_store_size(p, v) \
+  __atomic_store_n((p), (size_t)(v), __ATOMIC_SEQ_CST)
+#define jts_atomic_load_size(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#endif
+
+// state marshaled by sharing a pointer can only be marshaled in unsafe
+// mode (as done when sending to another thread), so check before taking
+// a reference that would otherwise leak
+static void jts_marshal_check_unsafe(JanetMarshalContext *ctx,
+                                     const char *what) {
+  if (!(ctx->flags & JANET_MARSHAL_UNSAFE)) {
+    janet_panicf("%s can only be marshaled in unsafe mode, "
+                 "e.g. to send it to another thread", what);
+  }
+}
+
+// monotonic clock in microseconds, for latency stats
+
+#if defined(WIN32) || defined(_WIN32)
+static uint64_t jts_now_micros(void) {
+  LARGE_INTEGER freq, now;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  return ((uint64_t)(now.QuadPart / freq.QuadPart) * 1000000) +
+    ((uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 /
+     (uint64_t)freq.QuadPart);
+}
+#else
+#include <time.h>
+#if !defined(CLOCK_MONOTONIC)
+#error "CLOCK_MONOTONIC is required for latency stats"
+#endif
+static uint64_t jts_now_micros(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000) + ((uint64_t)ts.tv_nsec / 1000);
+}
+#endif
+
+// read-only file mappings, returning 0 on success.  an empty file maps
+// to NULL with length 0.
+
+#if defined(WIN32) || defined(_WIN32)
+static int jts_map_file(const char *path, const uint8_t **data, size_t *len) {
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (INVALID_HANDLE_VALUE == file) {
+    return -1;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    return -1;
+  }
+  *data = NULL;
+  *len = (size_t)size.QuadPart;
+  if (0 == size.QuadPart) {
+    CloseHandle(file);
+    return 0;
+  }
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (NULL == mapping) {
+    return -1;
+  }
+  // the view keeps the mapping object alive
+  *data = (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  return (NULL == *data) ? -1 : 0;
+}
+static void jts_unmap_file(const uint8_t *data, size_t len) {
+  (void)len;
+  if (NULL != data) {
+    UnmapViewOfFile(data);
+  }
+}
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+static int jts_map_file(const char *path, const uint8_t **data, size_t *len) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if (0 != fstat(fd, &st)) {
+    close(fd);
+    return -1;
+  }
+  *data = NULL;
+  *len = (size_t)st.st_size;
+  if (0 == st.st_size) {
+    close(fd);
+    return 0;
+  }
+  void *addr = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid after the descriptor is closed
+  close(fd);
+  if (MAP_FAILED == addr) {
+    return -1;
+  }
+  *data = (const uint8_t *)addr;
+  return 0;
+}
+static void jts_unmap_file(const uint8_t *data, size_t len) {
+  if (NULL != data) {
+    (void)munmap((void *)data, len);
+  }
+}
+#endif
+
+// regular expressions for #match? query predicates
+
+#if defined(WIN32) || defined(_WIN32)
+#define JTS_HAVE_REGEX 0
+#else
+#include <regex.h>
+#define JTS_HAVE_REGEX 1
+#endif
+
+////////
+
 typedef TSLanguage *(*JTSLang)(void);
 
 ////////
@@ -90,52 +293,289 @@ const JanetAbstractType jts_language_type = {
   JANET_ATEND_GET
 };
 
+typedef struct {
+  TSParser *parser;
+  // nil or the tree-sitter/cancellation-flag in use, kept for gc
+  Janet cancellation_flag;
+  // pool the parser was checked out from (holding a reference), or NULL
+  struct JTSParserPool *pool;
+} JTSParser;
+
 static int jts_parser_gc(void *p, size_t size);
 
+static int jts_parser_gcmark(void *p, size_t size);
+
 static int jts_parser_get(void *p, Janet key, Janet *out);
 
 const JanetAbstractType jts_parser_type = {
   "tree-sitter/parser",
   jts_parser_gc,
-  NULL,
+  jts_parser_gcmark,
   jts_parser_get,
   JANET_ATEND_GET
 };
 
+// idle parsers for one language.  like cancellation flags, the pool
+// lives outside of janet's heap so janet threads can share it.
+
+typedef struct JTSParserPool {
+  const TSLanguage *language;
+  JTSMutex lock;
+  TSParser **idle;
+  uint32_t idle_count;
+  uint32_t capacity;
+  uint32_t in_use;
+  uint64_t checkouts;
+  uint64_t created;
+  uint64_t discarded;
+  uint64_t checkout_micros;
+  uint64_t max_checkout_micros;
+  int32_t refcount;
+} JTSParserPool;
+
+static void jts_parser_pool_return(JTSParserPool *pool, TSParser *parser);
+
+static void jts_parser_pool_unref(JTSParserPool *pool);
+
+static int jts_parser_pool_gc(void *p, size_t size);
+
+static int jts_parser_pool_get(void *p, Janet key, Janet *out);
+
+static void jts_parser_pool_marshal(void *p, JanetMarshalContext *ctx);
+
+static void *jts_parser_pool_unmarshal(JanetMarshalContext *ctx);
+
+const JanetAbstractType jts_parser_pool_type = {
+  "tree-sitter/parser-pool",
+  jts_parser_pool_gc,
+  NULL,
+  jts_parser_pool_get,
+  NULL,
+  jts_parser_pool_marshal,
+  jts_parser_pool_unmarshal,
+  JANET_ATEND_UNMARSHAL
+};
+
+// the flag itself lives outside of janet's heap so the same flag can be
+// shared with (and set from) other janet threads
+
+typedef struct {
+  size_t flag;
+  int32_t refcount;
+} JTSFlagState;
+
+static int jts_cancellation_flag_gc(void *p, size_t size);
+
+static int jts_cancellation_flag_get(void *p, Janet key, Janet *out);
+
+static void jts_cancellation_flag_marshal(void *p, JanetMarshalContext *ctx);
+
+static void *jts_cancellation_flag_unmarshal(JanetMarshalContext *ctx);
+
+const JanetAbstractType jts_cancellation_flag_type = {
+  "tree-sitter/cancellation-flag",
+  jts_cancellation_flag_gc,
+  NULL,
+  jts_cancellation_flag_get,
+  NULL,
+  jts_cancellation_flag_marshal,
+  jts_cancellation_flag_unmarshal,
+  JANET_ATEND_UNMARSHAL
+};
+
+typedef struct {
+  TSTree *tree;
+  // nil, or the source text the tree keeps alive (e.g. a file mapping)
+  Janet source;
+} JTSTree;
+
 static int jts_tree_gc(void *p, size_t size);
 
+static int jts_tree_gcmark(void *p, size_t size);
+
 static int jts_tree_get(void *p, Janet key, Janet *out);
 
+static void jts_tree_marshal(void *p, JanetMarshalContext *ctx);
+
+static void *jts_tree_unmarshal(JanetMarshalContext *ctx);
+
 const JanetAbstractType jts_tree_type = {
   "tree-sitter/tree",
   jts_tree_gc,
-  NULL,
+  jts_tree_gcmark,
   jts_tree_get,
-  JANET_ATEND_GET
+  NULL,
+  jts_tree_marshal,
+  jts_tree_unmarshal,
+  JANET_ATEND_UNMARSHAL
+};
+
+// lives outside the janet heap so that marshaled copies of a mapping
+// (e.g. the source of a tree sent to another thread) can share it
+typedef struct {
+  const uint8_t *data;
+  size_t len;
+  int32_t refcount;
+} JTSMapping;
+
+static int jts_mapping_gc(void *p, size_t size);
+
+static int jts_mapping_get(void *p, Janet key, Janet *out);
+
+static void jts_mapping_marshal(void *p, JanetMarshalContext *ctx);
+
+static void *jts_mapping_unmarshal(JanetMarshalContext *ctx);
+
+const JanetAbstractType jts_mapping_type = {
+  "tree-sitter/mapping",
+  jts_mapping_gc,
+  NULL,
+  jts_mapping_get,
+  NULL,
+  jts_mapping_marshal,
+  jts_mapping_unmarshal,
+  JANET_ATEND_UNMARSHAL
+};
+
+// compiled node predicate for native searches.  a constraint with
+// value -1 (or a NULL text) matches anything.
+typedef struct {
+  const TSLanguage *language;
+  // bitmap over all symbol ids, used if has_symbols
+  int has_symbols;
+  uint8_t symbols[65536 / 8];
+  int32_t field;
+  int32_t named;
+  int32_t extra;
+  uint8_t *text;
+  uint32_t text_len;
+} JTSSearchSpec;
+
+static int jts_search_spec_gc(void *p, size_t size);
+
+const JanetAbstractType jts_search_spec_type = {
+  "tree-sitter/search-spec",
+  jts_search_spec_gc,
+  JANET_ATEND_GC
 };
 
+typedef struct {
+  TSNode node;
+  // the tree abstract owning node.tree, kept alive by the node
+  Janet tree;
+} JTSNode;
+
+static int jts_node_gcmark(void *p, size_t size);
+
 static int jts_node_get(void *p, Janet key, Janet *out);
 
 const JanetAbstractType jts_node_type = {
   "tree-sitter/node",
   NULL,
-  NULL,
+  jts_node_gcmark,
   jts_node_get,
   JANET_ATEND_GET
 };
 
+static Janet jts_wrap_node(TSNode node, Janet tree);
+
+// flag bits of a node table entry
+#define JTS_NODE_NAMED 1
+#define JTS_NODE_MISSING 2
+#define JTS_NODE_EXTRA 4
+#define JTS_NODE_HAS_ERROR 8
+
+// nodes of a tree in pre-order, as parallel arrays
+typedef struct {
+  const TSLanguage *language;
+  uint32_t count;
+  uint32_t capacity;
+  TSSymbol *symbols;
+  // index of parent node, -1 for the root
+  int32_t *parents;
+  uint32_t *start_bytes;
+  uint32_t *end_bytes;
+  TSPoint *start_points;
+  TSPoint *end_points;
+  uint8_t *flags;
+} JTSNodeTable;
+
+static int jts_node_table_gc(void *p, size_t size);
+
+static int jts_node_table_get(void *p, Janet key, Janet *out);
+
+const JanetAbstractType jts_node_table_type = {
+  "tree-sitter/node-table",
+  jts_node_table_gc,
+  NULL,
+  jts_node_table_get,
+  JANET_ATEND_GET
+};
+
+static int jts_document_gc(void *p, size_t size);
+
+static int jts_document_gcmark(void *p, size_t size);
+
+static int jts_document_get(void *p, Janet key, Janet *out);
+
+const JanetAbstractType jts_document_type = {
+  "tree-sitter/document",
+  jts_document_gc,
+  jts_document_gcmark,
+  jts_document_get,
+  JANET_ATEND_GET
+};
+
+typedef struct {
+  TSTreeCursor cursor;
+  // the tree abstract the cursor walks
+  Janet tree;
+} JTSCursor;
+
 static int jts_cursor_gc(void *p, size_t size);
 
+static int jts_cursor_gcmark(void *p, size_t size);
+
 static int jts_cursor_get(void *p, Janet key, Janet *out);
 
 const JanetAbstractType jts_cursor_type = {
   "tree-sitter/cursor",
   jts_cursor_gc,
-  NULL,
+  jts_cursor_gcmark,
   jts_cursor_get,
   JANET_ATEND_GET
 };
 
+// text predicates evaluated natively by query cursors
+#define JTS_PRED_EQ 0
+#define JTS_PRED_MATCH 1
+#define JTS_PRED_ANY_OF 2
+
+typedef struct {
+  int kind;
+  int negate;
+  uint32_t capture_id;
+  // second capture of #eq?, or -1 when comparing against strings
+  int64_t other_capture_id;
+  // string ids of the query's string literals
+  uint32_t *value_ids;
+  uint32_t value_count;
+#if JTS_HAVE_REGEX
+  int has_regex;
+  regex_t regex;
+#endif
+} JTSPredicate;
+
+typedef struct {
+  TSQuery *query;
+  JTSPredicate *predicates;
+  uint32_t predicate_count;
+  // predicates of pattern i are [pattern_starts[i], pattern_starts[i + 1])
+  uint32_t *pattern_starts;
+  // queries are shared via the query cache, see jts_query_release
+  int32_t refcount;
+} JTSQuery;
+
 static int jts_query_gc(void *p, size_t size);
 
 static int jts_query_get(void *p, Janet key, Janet *out);
@@ -148,63 +588,240 @@ const JanetAbstractType jts_query_type = {
   JANET_ATEND_GET
 };
 
+// growable NUL-terminated copy of capture text for regexec
+typedef struct {
+  char *data;
+  size_t capacity;
+} JTSScratch;
+
+typedef struct {
+  TSQueryCursor *cursor;
+  // query, tree, and source (or nil) of the last exec
+  Janet query;
+  Janet tree;
+  Janet source;
+  // byte offset of the parsed text within source
+  int32_t source_offset;
+  // counted since the last exec
+  uint32_t matches;
+  uint32_t captures;
+  // predicate result for the match whose captures are being returned
+  int has_last_match;
+  uint32_t last_match_id;
+  int last_match_passed;
+  // NUL-terminated copy of text for regexec
+  JTSScratch scratch;
+} JTSQueryCursor;
+
 static int jts_query_cursor_gc(void *p, size_t size);
 
+static int jts_query_cursor_gcmark(void *p, size_t size);
+
 static int jts_query_cursor_get(void *p, Janet key, Janet *out);
 
 const JanetAbstractType jts_query_cursor_type = {
   "tree-sitter/query_cursor",
   jts_query_cursor_gc,
-  NULL,
+  jts_query_cursor_gcmark,
   jts_query_cursor_get,
   JANET_ATEND_GET
 };
 
-//////// start cfun_ts_init ////////
+//////// start grammar registry ////////
 
-static Janet cfun_ts_init(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 2);
+// each grammar's shared object is loaded at most once per process.  the
+// handle is deliberately never closed as trees, queries, etc. may refer
+// to the language for as long as the process lives.  loads that fail are
+// not remembered, so a grammar built (or a cwd changed) after a failed
+// attempt is picked up by the next call.
 
-  const char *path = (const char *)janet_getstring(argv, 0);
-  if (NULL == path) {
-    (void)fprintf(stderr, "path to shared object unspecified\n");
-    return janet_wrap_nil();
+typedef struct JTSGrammar {
+  struct JTSGrammar *next;
+  char *path;
+  char *fn_name;
+  Clib lib;
+  const TSLanguage *language;
+} JTSGrammar;
+
+static JTSMutex jts_registry_lock = JTS_MUTEX_INIT;
+static JTSGrammar *jts_registry = NULL;
+static size_t jts_registry_count = 0;
+static size_t jts_registry_failures = 0;
+static size_t jts_registry_hits = 0;
+static size_t jts_registry_misses = 0;
+
+static char *jts_strdup(const char *s) {
+  size_t len = strlen(s);
+  char *copy = (char *)malloc(len + 1);
+  if (NULL != copy) {
+    memcpy(copy, s, len + 1);
+  }
+  return copy;
+}
+
+// caller holds jts_registry_lock
+static bool jts_registry_add(const char *path, const char *fn_name,
+                             Clib lib, const TSLanguage *lang) {
+  JTSGrammar *g = (JTSGrammar *)malloc(sizeof(JTSGrammar));
+  if (NULL == g) {
+    return false;
+  }
+
+  g->path = jts_strdup(path);
+  g->fn_name = jts_strdup(fn_name);
+  if ((NULL == g->path) || (NULL == g->fn_name)) {
+    free(g->path);
+    free(g->fn_name);
+    free(g);
+    return false;
+  }
+
+  g->lib = lib;
+  g->language = lang;
+  g->next = jts_registry;
+  jts_registry = g;
+
+  jts_registry_count++;
+
+  return true;
+}
+
+static const TSLanguage *jts_registry_lookup(const char *path,
+                                             const char *fn_name) {
+  const TSLanguage *lang = NULL;
+
+  jts_mutex_lock(&jts_registry_lock);
+
+  for (JTSGrammar *g = jts_registry; g != NULL; g = g->next) {
+    if ((0 == strcmp(g->path, path)) && (0 == strcmp(g->fn_name, fn_name))) {
+      jts_registry_hits++;
+      lang = g->language;
+      goto done;
+    }
   }
 
   Clib lib = load_clib(path);
   if (NULL == lib) {
     (void)fprintf(stderr, "%s\n", error_clib());
-    return janet_wrap_nil();
-  }
-
-  const char *fn_name = (const char *)janet_getstring(argv, 1);
-  if (NULL == fn_name) {
-    (void)fprintf(stderr, "function name unspecified\n");
-    return janet_wrap_nil();
+    jts_registry_failures++;
+    goto done;
   }
 
   JTSLang jtsl = (JTSLang)symbol_clib(lib, fn_name);
   if (NULL == jtsl) {
     (void)fprintf(stderr, "could not find the target grammar's initializer\n");
-    return janet_wrap_nil();
+    close_clib(lib);
+    jts_registry_failures++;
+    goto done;
+  }
+
+  const TSLanguage *loaded = jtsl();
+  if (NULL == loaded) {
+    (void)fprintf(stderr, "the target grammar's initializer failed\n");
+    close_clib(lib);
+    jts_registry_failures++;
+    goto done;
+  }
+
+  if (!jts_registry_add(path, fn_name, lib, loaded)) {
+    (void)fprintf(stderr, "failed to allocate registry entry\n");
+    close_clib(lib);
+    jts_registry_failures++;
+    goto done;
   }
 
-  TSParser **parser_pp =
-    (TSParser **)janet_abstract(&jts_parser_type, sizeof(TSParser *));
-  *parser_pp = ts_parser_new();
+  jts_registry_misses++;
+  lang = loaded;
+
+done:
+  jts_mutex_unlock(&jts_registry_lock);
+
+  return lang;
+}
+
+static Janet jts_wrap_language(const TSLanguage *lang) {
+  TSLanguage **lang_pp =
+    (TSLanguage **)janet_abstract(&jts_language_type, sizeof(TSLanguage *));
+
+  // XXX: casting to avoid warning, but don't really want to
+  //      allow *lang_pp to be modified after this point?
+  *lang_pp = (TSLanguage *)lang;
+
+  return janet_wrap_abstract(lang_pp);
+}
+
+static Janet jts_wrap_new_parser(const TSLanguage *lang) {
+  JTSParser *parser_p =
+    (JTSParser *)janet_abstract(&jts_parser_type, sizeof(JTSParser));
+  parser_p->cancellation_flag = janet_wrap_nil();
+  parser_p->pool = NULL;
+  parser_p->parser = ts_parser_new();
 
-  if (NULL == *parser_pp) {
+  if (NULL == parser_p->parser) {
     (void)fprintf(stderr, "ts_parser_new failed\n");
     return janet_wrap_nil();
   }
 
-  if (!ts_parser_set_language(*parser_pp, jtsl())) {
-    ts_parser_delete(*parser_pp);
+  if (!ts_parser_set_language(parser_p->parser, lang)) {
+    ts_parser_delete(parser_p->parser);
+    parser_p->parser = NULL;
     (void)fprintf(stderr, "ts_parser_set_language failed\n");
     return janet_wrap_nil();
   }
 
-  return janet_wrap_abstract(parser_pp);
+  return janet_wrap_abstract(parser_p);
+}
+
+static Janet cfun_ts_language(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  const char *path = (const char *)janet_getstring(argv, 0);
+  const char *fn_name = (const char *)janet_getstring(argv, 1);
+
+  const TSLanguage *lang = jts_registry_lookup(path, fn_name);
+  if (NULL == lang) {
+    return janet_wrap_nil();
+  }
+
+  return jts_wrap_language(lang);
+}
+
+static Janet cfun_ts_registry_stats(int32_t argc, Janet *argv) {
+  (void)argv;
+  janet_fixarity(argc, 0);
+
+  jts_mutex_lock(&jts_registry_lock);
+  double count = (double)jts_registry_count;
+  double failures = (double)jts_registry_failures;
+  double hits = (double)jts_registry_hits;
+  double misses = (double)jts_registry_misses;
+  jts_mutex_unlock(&jts_registry_lock);
+
+  JanetKV *st = janet_struct_begin(4);
+  janet_struct_put(st, janet_ckeywordv("languages"), janet_wrap_number(count));
+  janet_struct_put(st, janet_ckeywordv("failures"), janet_wrap_number(failures));
+  janet_struct_put(st, janet_ckeywordv("hits"), janet_wrap_number(hits));
+  janet_struct_put(st, janet_ckeywordv("misses"), janet_wrap_number(misses));
+
+  return janet_wrap_struct(janet_struct_end(st));
+}
+
+//////// end grammar registry ////////
+
+//////// start cfun_ts_init ////////
+
+static Janet cfun_ts_init(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  const char *path = (const char *)janet_getstring(argv, 0);
+  const char *fn_name = (const char *)janet_getstring(argv, 1);
+
+  const TSLanguage *lang = jts_registry_lookup(path, fn_name);
+  if (NULL == lang) {
+    return janet_wrap_nil();
+  }
+
+  return jts_wrap_new_parser(lang);
 }
 
 //////// end cfun_ts_init ////////
@@ -229,1057 +846,4799 @@ static Janet cfun_language_version(int32_t argc, Janet *argv) {
   return janet_wrap_integer(ts_language_version(*lang_pp));
 }
 
-static const JanetMethod language_methods[] = {
-  //{"symbol-count", cfun_language_symbol_count},
-  //{"symbol-name", cfun_language_symbol_name},
-  //{"symbol-for-name", cfun_language_symbol_for_name},
-  //{"field-count", cfun_language_field_count},
-  //{"field-name-for-id", cfun_language_field_name_for_id},
-  //{"field-name-for-name", cfun_language_field_name_for_name},
-  //{"symbol-type", cfun_language_symbol_type},
-  {"version", cfun_language_version},
-  {NULL, NULL}
-};
+/**
+ * Create a new parser that uses this language.
+ */
+static Janet cfun_language_parser(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
 
-static int jts_language_get(void *p, Janet key, Janet *out) {
-  (void) p;
+  TSLanguage **lang_pp = jts_get_language(argv, 0);
 
-  if (!janet_checktype(key, JANET_KEYWORD)) {
-    return 0;
-  }
+  return jts_wrap_new_parser(*lang_pp);
+}
 
-  return janet_getmethod(janet_unwrap_keyword(key), language_methods, out);
+/**
+ * Get the number of distinct node types in the language.
+ */
+static Janet cfun_language_symbol_count(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  TSLanguage **lang_pp = jts_get_language(argv, 0);
+
+  return janet_wrap_number((double)ts_language_symbol_count(*lang_pp));
 }
 
-////////
+static TSSymbol jts_get_symbol(const Janet *argv, int32_t n) {
+  int32_t sym = janet_getinteger(argv, n);
+  if ((sym < 0) || (sym > UINT16_MAX)) {
+    janet_panicf("expected symbol or field id, got %v", argv[n]);
+  }
 
-static TSNode *jts_get_node(const Janet *argv, int32_t n) {
-  return (TSNode *)janet_getabstract(argv, n, &jts_node_type);
+  return (TSSymbol)sym;
 }
 
 /**
- * Get the node's type as a null-terminated string.
+ * Get a node type string for the given numerical id.
  */
-static Janet cfun_node_type(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 1);
+static Janet cfun_language_symbol_name(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
 
-  TSNode node = *jts_get_node(argv, 0);
+  TSLanguage **lang_pp = jts_get_language(argv, 0);
+  TSSymbol sym = jts_get_symbol(argv, 1);
 
-  const char *the_type = ts_node_type(node);
-  if (NULL == the_type) {
+  const char *name = ts_language_symbol_name(*lang_pp, sym);
+  if (NULL == name) {
     return janet_wrap_nil();
   }
 
-  return janet_cstringv(the_type);
+  return janet_cstringv(name);
 }
 
 /**
- * Get the node's start byte.
+ * Get the numerical id for the given node type string, or nil if there
+ * is no such node type.  `is-named` defaults to true.
  */
-static Janet cfun_node_start_byte(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 1);
+static Janet cfun_language_symbol_for_name(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 3);
 
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
+  TSLanguage **lang_pp = jts_get_language(argv, 0);
+  JanetByteView name = janet_getbytes(argv, 1);
+  bool is_named = (argc > 2) ? janet_truthy(argv[2]) : true;
+
+  TSSymbol sym =
+    ts_language_symbol_for_name(*lang_pp, (const char *)name.bytes,
+                                (uint32_t)name.len, is_named);
+  if (0 == sym) {
     return janet_wrap_nil();
   }
 
-  return janet_wrap_integer(ts_node_start_byte(node));
+  return janet_wrap_integer(sym);
 }
 
 /**
- * Get the node's start position row and column.
+ * Check whether the given node type id belongs to named nodes, anonymous
+ * nodes, or hidden nodes: returns `:regular`, `:anonymous`, or
+ * `:auxiliary`.
+ *
+ * See also `ts_node_is_named`. Hidden nodes are never returned from the API.
  */
-static Janet cfun_node_start_point(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 1);
+static Janet cfun_language_symbol_type(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
 
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
-    return janet_wrap_nil();
+  TSLanguage **lang_pp = jts_get_language(argv, 0);
+  TSSymbol sym = jts_get_symbol(argv, 1);
+
+  switch (ts_language_symbol_type(*lang_pp, sym)) {
+    case TSSymbolTypeRegular:
+      return janet_ckeywordv("regular");
+    case TSSymbolTypeAnonymous:
+      return janet_ckeywordv("anonymous");
+    default:
+      return janet_ckeywordv("auxiliary");
   }
-
-  TSPoint point = ts_node_start_point(node);
-
-  Janet *tup = janet_tuple_begin(2);
-  tup[0] = janet_wrap_integer(point.row);
-  tup[1] = janet_wrap_integer(point.column);
-
-  return janet_wrap_tuple(janet_tuple_end(tup));
 }
 
 /**
- * Get the node's end byte.
+ * Get the number of distinct field names in the language.
  */
-static Janet cfun_node_end_byte(int32_t argc, Janet *argv) {
+static Janet cfun_language_field_count(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
 
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
-    return janet_wrap_nil();
-  }
+  TSLanguage **lang_pp = jts_get_language(argv, 0);
 
-  return janet_wrap_integer(ts_node_end_byte(node));
+  return janet_wrap_number((double)ts_language_field_count(*lang_pp));
 }
 
 /**
- * Get the node's end position row and column.
+ * Get the field name string for the given numerical id.
  */
-static Janet cfun_node_end_point(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 1);
+static Janet cfun_language_field_name_for_id(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
 
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
+  TSLanguage **lang_pp = jts_get_language(argv, 0);
+  TSFieldId id = (TSFieldId)jts_get_symbol(argv, 1);
+
+  const char *name = ts_language_field_name_for_id(*lang_pp, id);
+  if (NULL == name) {
     return janet_wrap_nil();
   }
 
-  TSPoint point = ts_node_end_point(node);
-
-  Janet *tup = janet_tuple_begin(2);
-  tup[0] = janet_wrap_integer(point.row);
-  tup[1] = janet_wrap_integer(point.column);
-
-  return janet_wrap_tuple(janet_tuple_end(tup));
+  return janet_cstringv(name);
 }
 
 /**
- * Get an S-expression representing the node as a string.
- *
- * This string is allocated with `malloc` and the caller is responsible for
- * freeing it using `free`.
+ * Get the numerical id for the given field name string, or nil if there
+ * is no such field.
  */
-static Janet cfun_node_string(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 1);
+static Janet cfun_language_field_id_for_name(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
 
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
-    return janet_wrap_nil();
-  }
+  TSLanguage **lang_pp = jts_get_language(argv, 0);
+  JanetByteView name = janet_getbytes(argv, 1);
 
-  char *text = ts_node_string(node);
-  if (NULL == text) {
+  TSFieldId id =
+    ts_language_field_id_for_name(*lang_pp, (const char *)name.bytes,
+                                  (uint32_t)name.len);
+  if (0 == id) {
     return janet_wrap_nil();
   }
 
-  return janet_cstringv(text);
+  return janet_wrap_integer(id);
 }
 
-/**
- * Check if the node is null. Functions like `ts_node_child` and
- * `ts_node_next_sibling` will return a null node to indicate that no such node
- * was found.
- */
-static Janet cfun_node_is_null(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 1);
+// per janet vm (hence thread local) cache of tuples mapping symbol ids
+// to keywords, keyed by language.  keywords are interned, but getting
+// one from a C string still means hashing it.  the module entry resets
+// it, as a vm deinit'd and re-init'd on this thread frees the table.
+static JANET_THREAD_LOCAL JanetTable *jts_keyword_cache = NULL;
 
-  TSNode node = *jts_get_node(argv, 0);
+static const Janet *jts_symbol_keywords(const TSLanguage *lang) {
+  if (NULL == jts_keyword_cache) {
+    jts_keyword_cache = janet_table(0);
+    janet_gcroot(janet_wrap_table(jts_keyword_cache));
+  }
 
-  if (ts_node_is_null(node)) {
-    return janet_wrap_true();
+  Janet key = janet_wrap_pointer((void *)lang);
+  Janet kws = janet_table_get(jts_keyword_cache, key);
+  if (janet_checktype(kws, JANET_TUPLE)) {
+    return janet_unwrap_tuple(kws);
   }
 
-  return janet_wrap_false();
+  uint32_t count = ts_language_symbol_count(lang);
+  Janet *tup = janet_tuple_begin((int32_t)count);
+  for (uint32_t i = 0; i < count; i++) {
+    const char *name = ts_language_symbol_name(lang, (TSSymbol)i);
+    tup[i] = (NULL == name) ? janet_wrap_nil() : janet_ckeywordv(name);
+  }
+
+  const Janet *kws_tup = janet_tuple_end(tup);
+  janet_table_put(jts_keyword_cache, key, janet_wrap_tuple(kws_tup));
+
+  return kws_tup;
 }
 
 /**
- * Check if the node is *named*. Named nodes correspond to named rules in the
- * grammar, whereas *anonymous* nodes correspond to string literals in the
- * grammar.
+ * Get a tuple of keywords indexed by symbol id, e.g. for turning the
+ * result of a node's `:symbol` into its type.  The tuple is built once
+ * per language.
  */
-static Janet cfun_node_is_named(int32_t argc, Janet *argv) {
+static Janet cfun_language_symbol_keywords(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
 
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
-    return janet_wrap_nil();
+  TSLanguage **lang_pp = jts_get_language(argv, 0);
+
+  return janet_wrap_tuple(jts_symbol_keywords(*lang_pp));
+}
+
+// as for jts_keyword_cache, but caching structs mapping field name
+// keywords to field ids
+static JANET_THREAD_LOCAL JanetTable *jts_field_cache = NULL;
+
+static const JanetKV *jts_field_ids(const TSLanguage *lang) {
+  if (NULL == jts_field_cache) {
+    jts_field_cache = janet_table(0);
+    janet_gcroot(janet_wrap_table(jts_field_cache));
   }
 
-  if (ts_node_is_named(node)) {
-    return janet_wrap_true();
+  Janet key = janet_wrap_pointer((void *)lang);
+  Janet ids = janet_table_get(jts_field_cache, key);
+  if (janet_checktype(ids, JANET_STRUCT)) {
+    return janet_unwrap_struct(ids);
   }
 
-  return janet_wrap_false();
+  // field ids start at 1
+  uint32_t count = ts_language_field_count(lang);
+  JanetKV *st = janet_struct_begin((int32_t)count);
+  for (uint32_t i = 1; i <= count; i++) {
+    const char *name = ts_language_field_name_for_id(lang, (TSFieldId)i);
+    if (NULL != name) {
+      janet_struct_put(st, janet_ckeywordv(name), janet_wrap_integer(i));
+    }
+  }
+
+  const JanetKV *ids_st = janet_struct_end(st);
+  janet_table_put(jts_field_cache, key, janet_wrap_struct(ids_st));
+
+  return ids_st;
 }
 
 /**
- * Check if the node is a syntax error or contains any syntax errors.
+ * Get the field id for argument `n`, given as an id, a keyword (looked
+ * up in the language's cached field table), or a string.  Returns 0 for
+ * an unknown field name.
  */
-static Janet cfun_node_has_error(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 1);
-
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
-    return janet_wrap_nil();
+static TSFieldId jts_get_field_id(const TSLanguage *lang, const Janet *argv,
+                                  int32_t n) {
+  if (janet_checktype(argv[n], JANET_NUMBER)) {
+    return (TSFieldId)jts_get_symbol(argv, n);
   }
 
-  if (ts_node_has_error(node)) {
-    return janet_wrap_true();
+  if (janet_checktype(argv[n], JANET_KEYWORD)) {
+    Janet id = janet_struct_get(jts_field_ids(lang), argv[n]);
+    return janet_checktype(id, JANET_NUMBER) ?
+           (TSFieldId)janet_unwrap_integer(id) : 0;
   }
 
-  return janet_wrap_false();
+  JanetByteView name = janet_getbytes(argv, n);
+
+  return ts_language_field_id_for_name(lang, (const char *)name.bytes,
+                                       (uint32_t)name.len);
 }
 
 /**
- * Get the node's immediate parent.
+ * Get a struct mapping the language's field names, as keywords, to
+ * field ids.  The struct is built once per language.
  */
-static Janet cfun_node_parent(int32_t argc, Janet *argv) {
+static Janet cfun_language_field_ids(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
 
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
-    return janet_wrap_nil();
-  }
+  TSLanguage **lang_pp = jts_get_language(argv, 0);
 
-  TSNode *parent_p =
-    (TSNode *)janet_abstract(&jts_node_type, sizeof(TSNode));
+  return janet_wrap_struct(jts_field_ids(*lang_pp));
+}
 
-  *parent_p = ts_node_parent(node);
-  if (ts_node_is_null(*parent_p)) {
-    return janet_wrap_nil();
+static const JanetMethod language_methods[] = {
+  {"symbol-count", cfun_language_symbol_count},
+  {"symbol-name", cfun_language_symbol_name},
+  {"symbol-for-name", cfun_language_symbol_for_name},
+  {"field-count", cfun_language_field_count},
+  {"field-name-for-id", cfun_language_field_name_for_id},
+  {"field-id-for-name", cfun_language_field_id_for_name},
+  {"symbol-type", cfun_language_symbol_type},
+  {"version", cfun_language_version},
+  // custom
+  {"parser", cfun_language_parser},
+  {"symbol-keywords", cfun_language_symbol_keywords},
+  {"field-ids", cfun_language_field_ids},
+  {NULL, NULL}
+};
+
+static int jts_language_get(void *p, Janet key, Janet *out) {
+  (void) p;
+
+  if (!janet_checktype(key, JANET_KEYWORD)) {
+    return 0;
   }
 
-  return janet_wrap_abstract(parent_p);
+  return janet_getmethod(janet_unwrap_keyword(key), language_methods, out);
+}
+
+////////
+
+static JTSMapping *jts_get_mapping(const Janet *argv, int32_t n) {
+  return *(JTSMapping **)janet_getabstract(argv, n, &jts_mapping_type);
 }
 
 /**
- * Get the node's child at the given index, where zero represents the first
- * child.
+ * Map the file at `path` read-only into memory.  Returns nil if the file
+ * cannot be mapped or is too large for tree-sitter's 32-bit offsets.
  */
-static Janet cfun_node_child(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 2);
-
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
+static Janet jts_wrap_mapping(const char *path) {
+  const uint8_t *data = NULL;
+  size_t len = 0;
+  if (0 != jts_map_file(path, &data, &len)) {
+    fprintf(stderr, "failed to map file: %s\n", path);
     return janet_wrap_nil();
   }
 
-  // XXX: how to handle negative appropriately?
-  uint32_t idx = (uint32_t)janet_getinteger(argv, 1);
+  if (len > INT32_MAX) {
+    jts_unmap_file(data, len);
+    fprintf(stderr, "file too large to parse: %s\n", path);
+    return janet_wrap_nil();
+  }
 
-  TSNode *child_p =
-    (TSNode *)janet_abstract(&jts_node_type, sizeof(TSNode));
+  JTSMapping **mapping_pp =
+    (JTSMapping **)janet_abstract(&jts_mapping_type, sizeof(JTSMapping *));
 
-  *child_p = ts_node_child(node, idx);
-  if (ts_node_is_null(*child_p)) {
-    return janet_wrap_nil();
+  *mapping_pp = (JTSMapping *)malloc(sizeof(JTSMapping));
+  if (NULL == *mapping_pp) {
+    jts_unmap_file(data, len);
+    janet_panic("failed to allocate mapping");
   }
+  (*mapping_pp)->data = data;
+  (*mapping_pp)->len = len;
+  (*mapping_pp)->refcount = 1;
 
-  return janet_wrap_abstract(child_p);
+  return janet_wrap_abstract(mapping_pp);
 }
 
 /**
- * Get the field name for node's child at the given index, where zero represents
- * the first child. Returns NULL, if no field is found.
- */
-//const char *ts_node_field_name_for_child(TSNode, uint32_t);
-
-/**
- * Get the node's number of children.
+ * Source text given as a string, a buffer, or a file mapping.
  */
-static Janet cfun_node_child_count(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 1);
-
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
-    return janet_wrap_nil();
+static JanetByteView jts_get_source(const Janet *argv, int32_t n) {
+  if (janet_checkabstract(argv[n], &jts_mapping_type)) {
+    JTSMapping *mapping_p = *(JTSMapping **)janet_unwrap_abstract(argv[n]);
+    JanetByteView view;
+    view.bytes = mapping_p->data;
+    view.len = (int32_t)mapping_p->len;
+    return view;
   }
 
-  // XXX: how to handle negative appropriately?
-  return janet_wrap_integer(ts_node_child_count(node));
+  return janet_getbytes(argv, n);
 }
 
-/**
- * Get the node's *named* child at the given index.
- */
-static Janet cfun_node_named_child(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 2);
-
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
-    return janet_wrap_nil();
+// the part of `source` from byte `offset` on, i.e. the text a tree from
+// parse-bytes with that start offset has its byte offsets relative to
+static JanetByteView jts_source_from(JanetByteView source, int32_t offset) {
+  if (offset > source.len) {
+    janet_panicf("offset %d is beyond end of source (length %d)",
+                 offset, source.len);
   }
 
-  // XXX: how to handle negative appropriately?
-  uint32_t idx = (uint32_t)janet_getinteger(argv, 1);
+  source.bytes += offset;
+  source.len -= offset;
+
+  return source;
+}
 
-  TSNode *child_p =
-    (TSNode *)janet_abstract(&jts_node_type, sizeof(TSNode));
+static Janet cfun_mapping_new(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
 
-  *child_p = ts_node_named_child(node, idx);
-  if (ts_node_is_null(*child_p)) {
-    return janet_wrap_nil();
-  }
+  const char *path = (const char *)janet_getcstring(argv, 0);
 
-  return janet_wrap_abstract(child_p);
+  return jts_wrap_mapping(path);
 }
 
 /**
- * Get the node's number of *named* children.
+ * Get the length of the mapped file in bytes.
  */
-static Janet cfun_node_named_child_count(int32_t argc, Janet *argv) {
+static Janet cfun_mapping_length(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
 
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
-    return janet_wrap_nil();
-  }
+  JTSMapping *mapping_p = jts_get_mapping(argv, 0);
 
-  // XXX: how to handle negative appropriately?
-  return janet_wrap_integer(ts_node_named_child_count(node));
+  return janet_wrap_integer((int32_t)mapping_p->len);
 }
 
 /**
- * Get the node's child with the given field name.
+ * Copy the bytes from `start` up to (not including) `end` into a new
+ * string.  `end` defaults to the end of the mapping.
  */
-/*
-TSNode ts_node_child_by_field_name(
-  TSNode self,
-  const char *field_name,
-  uint32_t field_name_length
-);
-*/
+static Janet cfun_mapping_slice(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, 3);
 
-/**
- * Get the node's next sibling.
- */
-static Janet cfun_node_next_sibling(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 1);
+  JTSMapping *mapping_p = jts_get_mapping(argv, 0);
+  int32_t len = (int32_t)mapping_p->len;
 
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
-    return janet_wrap_nil();
+  int32_t start = janet_optnat(argv, argc, 1, 0);
+  int32_t end = janet_optnat(argv, argc, 2, len);
+  if ((start > end) || (end > len)) {
+    janet_panicf("range [%d, %d) is outside mapping (length %d)",
+                 start, end, len);
   }
 
-  TSNode *sibling_p =
-    (TSNode *)janet_abstract(&jts_node_type, sizeof(TSNode));
-
-  *sibling_p = ts_node_next_sibling(node);
-  if (ts_node_is_null(*sibling_p)) {
-    return janet_wrap_nil();
+  if (start == end) {
+    return janet_cstringv("");
   }
 
-  return janet_wrap_abstract(sibling_p);
+  return janet_stringv(mapping_p->data + start, end - start);
 }
 
-/**
- * Get the node's previous sibling.
- */
-static Janet cfun_node_prev_sibling(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 1);
+static const JanetMethod mapping_methods[] = {
+  {"length", cfun_mapping_length},
+  {"slice", cfun_mapping_slice},
+  {NULL, NULL}
+};
 
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
-    return janet_wrap_nil();
+static int jts_mapping_gc(void *p, size_t size) {
+  (void) size;
+
+  JTSMapping **mapping_pp = (JTSMapping **)p;
+  if (*mapping_pp != NULL) {
+    if (0 == jts_atomic_dec(&(*mapping_pp)->refcount)) {
+      jts_unmap_file((*mapping_pp)->data, (*mapping_pp)->len);
+      free(*mapping_pp);
+    }
+    *mapping_pp = NULL;
   }
 
-  TSNode *sibling_p =
-    (TSNode *)janet_abstract(&jts_node_type, sizeof(TSNode));
+  return 0;
+}
 
-  *sibling_p = ts_node_prev_sibling(node);
-  if (ts_node_is_null(*sibling_p)) {
-    return janet_wrap_nil();
+static int jts_mapping_get(void *p, Janet key, Janet *out) {
+  (void) p;
+
+  if (!janet_checktype(key, JANET_KEYWORD)) {
+    return 0;
   }
 
-  return janet_wrap_abstract(sibling_p);
+  return janet_getmethod(janet_unwrap_keyword(key), mapping_methods, out);
 }
 
-/**
- * Get the node's first child that extends beyond the given byte offset.
- */
-static Janet cfun_node_first_child_for_byte(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 2);
+// as with cancellation flags, marshaling shares the mapping -- only
+// meaningful within one process
 
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
-    return janet_wrap_nil();
-  }
+static void jts_mapping_marshal(void *p, JanetMarshalContext *ctx) {
+  JTSMapping **mapping_pp = (JTSMapping **)p;
 
-  // XXX: check for non-negative number?
-  uint32_t idx = (uint32_t)janet_getinteger(argv, 1);
+  jts_marshal_check_unsafe(ctx, "mapping");
+  janet_marshal_abstract(ctx, p);
+  jts_atomic_inc(&(*mapping_pp)->refcount);
+  janet_marshal_ptr(ctx, *mapping_pp);
+}
 
-  TSNode *child_p =
-    (TSNode *)janet_abstract(&jts_node_type, sizeof(TSNode));
+static void *jts_mapping_unmarshal(JanetMarshalContext *ctx) {
+  JTSMapping **mapping_pp =
+    (JTSMapping **)janet_unmarshal_abstract(ctx, sizeof(JTSMapping *));
 
-  *child_p = ts_node_first_child_for_byte(node, idx);
-  if (ts_node_is_null(*child_p)) {
-    return janet_wrap_nil();
-  }
+  *mapping_pp = (JTSMapping *)janet_unmarshal_ptr(ctx);
 
-  return janet_wrap_abstract(child_p);
+  return mapping_pp;
 }
 
-/**
- * Get the node's first named child that extends beyond the given byte offset.
- */
-static Janet cfun_node_first_named_child_for_byte(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 2);
+////////
 
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
-    return janet_wrap_nil();
-  }
+static JTSSearchSpec *jts_get_search_spec(const Janet *argv, int32_t n) {
+  return (JTSSearchSpec *)janet_getabstract(argv, n, &jts_search_spec_type);
+}
 
-  // XXX: check for non-negative number?
-  uint32_t idx = (uint32_t)janet_getinteger(argv, 1);
+static void jts_search_spec_add_type(JTSSearchSpec *spec, Janet name) {
+  JanetByteView the_type = janet_getbytes(&name, 0);
+
+  // a name can belong to several symbols, e.g. via aliases, so every
+  // symbol with the name matches.  the error symbol is outside the
+  // regular range.
+  int found = 0;
+  uint32_t count = ts_language_symbol_count(spec->language);
+  for (uint32_t i = 0; i <= count; i++) {
+    TSSymbol symbol = (i == count) ? ts_builtin_sym_error : (TSSymbol)i;
+    const char *symbol_name = ts_language_symbol_name(spec->language, symbol);
+    if ((NULL != symbol_name) &&
+        (strlen(symbol_name) == (size_t)the_type.len) &&
+        (0 == memcmp(symbol_name, the_type.bytes, (size_t)the_type.len))) {
+      spec->symbols[symbol / 8] |= (uint8_t)(1 << (symbol % 8));
+      found = 1;
+    }
+  }
 
-  TSNode *child_p =
-    (TSNode *)janet_abstract(&jts_node_type, sizeof(TSNode));
+  if (!found) {
+    janet_panicf("unknown node type: %v", name);
+  }
+}
 
-  *child_p = ts_node_first_named_child_for_byte(node, idx);
-  if (ts_node_is_null(*child_p)) {
-    return janet_wrap_nil();
+static int32_t jts_search_spec_flag(Janet value) {
+  if (janet_checktype(value, JANET_NIL)) {
+    return -1;
   }
 
-  return janet_wrap_abstract(child_p);
+  return janet_truthy(value) ? 1 : 0;
 }
 
 /**
- * Get the smallest node within this node that spans the given range of bytes.
+ * Compile a node predicate for `:search` and `:search-all`.
+ *
+ * `spec` is a struct or table with any of the keys:
+ *
+ * * `:type` - node type name (string or keyword), or an array / tuple
+ *   of names
+ * * `:field` - field name the node has within its parent, for the node
+ *   searched from too
+ * * `:named` - whether the node is named
+ * * `:extra` - whether the node is extra (e.g. a comment)
+ * * `:text` - the node's exact source text
+ *
+ * A node matches if it satisfies every given key.
  */
-static Janet cfun_node_descendant_for_byte_range(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 3);
+static Janet cfun_search_spec_new(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
 
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
-    return janet_wrap_nil();
+  TSLanguage **lang_pp = jts_get_language(argv, 0);
+
+  if (!janet_checktype(argv[1], JANET_STRUCT) &&
+      !janet_checktype(argv[1], JANET_TABLE)) {
+    janet_panicf("expected struct or table, got %v", argv[1]);
   }
 
-  uint32_t start = (uint32_t)janet_getinteger(argv, 1);
-  uint32_t end = (uint32_t)janet_getinteger(argv, 2);
+  JTSSearchSpec *spec =
+    (JTSSearchSpec *)janet_abstract(&jts_search_spec_type,
+                                    sizeof(JTSSearchSpec));
+  memset(spec, 0, sizeof(JTSSearchSpec));
+  spec->language = *lang_pp;
+  spec->field = -1;
+
+  Janet types = janet_get(argv[1], janet_ckeywordv("type"));
+  if (!janet_checktype(types, JANET_NIL)) {
+    spec->has_symbols = 1;
+    const Janet *items = NULL;
+    int32_t len = 0;
+    if (janet_indexed_view(types, &items, &len)) {
+      for (int32_t i = 0; i < len; i++) {
+        jts_search_spec_add_type(spec, items[i]);
+      }
+    } else {
+      jts_search_spec_add_type(spec, types);
+    }
+  }
 
-  TSNode *desc_p =
-    (TSNode *)janet_abstract(&jts_node_type, sizeof(TSNode));
+  Janet field = janet_get(argv[1], janet_ckeywordv("field"));
+  if (!janet_checktype(field, JANET_NIL)) {
+    JanetByteView name = janet_getbytes(&field, 0);
+    TSFieldId id =
+      ts_language_field_id_for_name(spec->language,
+                                    (const char *)name.bytes,
+                                    (uint32_t)name.len);
+    if (0 == id) {
+      janet_panicf("unknown field: %v", field);
+    }
+    spec->field = id;
+  }
 
-  *desc_p = ts_node_descendant_for_byte_range(node, start, end);
-  if (ts_node_is_null(*desc_p)) {
-    return janet_wrap_nil();
+  spec->named = jts_search_spec_flag(janet_get(argv[1],
+                                               janet_ckeywordv("named")));
+  spec->extra = jts_search_spec_flag(janet_get(argv[1],
+                                               janet_ckeywordv("extra")));
+
+  Janet text = janet_get(argv[1], janet_ckeywordv("text"));
+  if (!janet_checktype(text, JANET_NIL)) {
+    JanetByteView view = janet_getbytes(&text, 0);
+    // at least one byte so a failed allocation is unambiguous
+    spec->text = (uint8_t *)malloc((size_t)view.len + 1);
+    if (NULL == spec->text) {
+      janet_panic("failed to allocate search spec");
+    }
+    memcpy(spec->text, view.bytes, (size_t)view.len);
+    spec->text_len = (uint32_t)view.len;
   }
 
-  return janet_wrap_abstract(desc_p);
+  return janet_wrap_abstract(spec);
 }
 
-/**
- * Get the smallest node within this node that spans the given range of
- * (row, column) positions.
- */
-static Janet cfun_node_descendant_for_point_range(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 5);
-
-  TSNode node = *jts_get_node(argv, 0);
+// `field_id` is the field `node` has within its parent
+static int jts_search_spec_matches(const JTSSearchSpec *spec,
+                                   TSFieldId field_id,
+                                   TSNode node, JanetByteView source) {
+  if (spec->has_symbols) {
+    TSSymbol symbol = ts_node_symbol(node);
+    if (!(spec->symbols[symbol / 8] & (1 << (symbol % 8)))) {
+      return 0;
+    }
+  }
+
+  if ((spec->named >= 0) && (spec->named != (int32_t)ts_node_is_named(node))) {
+    return 0;
+  }
+
+  if ((spec->extra >= 0) && (spec->extra != (int32_t)ts_node_is_extra(node))) {
+    return 0;
+  }
+
+  if ((spec->field >= 0) && (spec->field != (int32_t)field_id)) {
+    return 0;
+  }
+
+  if (NULL != spec->text) {
+    uint32_t start = ts_node_start_byte(node);
+    uint32_t end = ts_node_end_byte(node);
+    if ((end - start != spec->text_len) || (end > (uint32_t)source.len) ||
+        (0 != memcmp(source.bytes + start, spec->text, spec->text_len))) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+// field id `node` has within its parent, 0 if none.  a cursor rooted
+// at `node` cannot see this, so look from the parent.
+static TSFieldId jts_field_id_in_parent(TSNode node) {
+  TSNode parent = ts_node_parent(node);
+  if (ts_node_is_null(parent)) {
+    return 0;
+  }
+
+  TSFieldId id = 0;
+
+  TSTreeCursor cursor = ts_tree_cursor_new(parent);
+  if (ts_tree_cursor_goto_first_child(&cursor)) {
+    do {
+      if (ts_node_eq(ts_tree_cursor_current_node(&cursor), node)) {
+        id = ts_tree_cursor_current_field_id(&cursor);
+        break;
+      }
+    } while (ts_tree_cursor_goto_next_sibling(&cursor));
+  }
+  ts_tree_cursor_delete(&cursor);
+
+  return id;
+}
+
+/**
+ * Pre-order walk of the subtree at `root` with a tree cursor, pushing
+ * each node matching `spec` to `found` until it holds `limit` nodes.
+ */
+static void jts_search(const JTSSearchSpec *spec, TSNode root, Janet tree,
+                       JanetByteView source, JanetArray *found,
+                       int32_t limit) {
+  TSTreeCursor cursor = ts_tree_cursor_new(root);
+
+  TSFieldId root_field_id = 0;
+  if (spec->field >= 0) {
+    root_field_id = jts_field_id_in_parent(root);
+  }
+
+  uint32_t depth = 0;
+  while (found->count < limit) {
+    TSNode node = ts_tree_cursor_current_node(&cursor);
+    TSFieldId field_id = (0 == depth) ?
+                         root_field_id :
+                         ts_tree_cursor_current_field_id(&cursor);
+    if (jts_search_spec_matches(spec, field_id, node, source)) {
+      janet_array_push(found, jts_wrap_node(node, tree));
+    }
+
+    if (ts_tree_cursor_goto_first_child(&cursor)) {
+      depth++;
+      continue;
+    }
+
+    int done = 0;
+    while (!ts_tree_cursor_goto_next_sibling(&cursor)) {
+      if ((0 == depth) || !ts_tree_cursor_goto_parent(&cursor)) {
+        done = 1;
+        break;
+      }
+      depth--;
+    }
+    if (done) {
+      break;
+    }
+  }
+
+  ts_tree_cursor_delete(&cursor);
+}
+
+static int jts_search_spec_gc(void *p, size_t size) {
+  (void) size;
+
+  JTSSearchSpec *spec = (JTSSearchSpec *)p;
+  free(spec->text);
+  spec->text = NULL;
+
+  return 0;
+}
+
+////////
+
+static JTSNode *jts_get_node(const Janet *argv, int32_t n) {
+  return (JTSNode *)janet_getabstract(argv, n, &jts_node_type);
+}
+
+/**
+ * Wrap `node` so that it keeps `tree`, the tree abstract owning it,
+ * alive.  Returns nil for a null node.
+ */
+static Janet jts_wrap_node(TSNode node, Janet tree) {
   if (ts_node_is_null(node)) {
     return janet_wrap_nil();
   }
 
-  uint32_t start_row = (uint32_t)janet_getinteger(argv, 1);
-  uint32_t start_col = (uint32_t)janet_getinteger(argv, 2);
-  uint32_t end_row = (uint32_t)janet_getinteger(argv, 3);
-  uint32_t end_col = (uint32_t)janet_getinteger(argv, 4);
+  JTSNode *node_p =
+    (JTSNode *)janet_abstract(&jts_node_type, sizeof(JTSNode));
+
+  node_p->node = node;
+  node_p->tree = tree;
+
+  return janet_wrap_abstract(node_p);
+}
+
+/**
+ * Get the node's type as a null-terminated string.
+ */
+static Janet cfun_node_type(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+
+  const char *the_type = ts_node_type(node);
+  if (NULL == the_type) {
+    return janet_wrap_nil();
+  }
+
+  return janet_cstringv(the_type);
+}
+
+/**
+ * Get the node's type as a numerical id.
+ */
+static Janet cfun_node_symbol(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  return janet_wrap_integer(ts_node_symbol(node));
+}
+
+static Janet jts_type_keyword(TSNode node) {
+  TSSymbol sym = ts_node_symbol(node);
+  const Janet *kws = jts_symbol_keywords(ts_tree_language(node.tree));
+  if (sym < (TSSymbol)janet_tuple_length(kws)) {
+    return kws[sym];
+  }
+
+  // e.g. ts_builtin_sym_error
+  return janet_ckeywordv(ts_node_type(node));
+}
+
+/**
+ * Get the node's type as a keyword, taken from a per-language table
+ * rather than built from the type string on each call.
+ */
+static Janet cfun_node_type_keyword(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  return jts_type_keyword(node);
+}
+
+/**
+ * Get the node's start byte.
+ */
+static Janet cfun_node_start_byte(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  return janet_wrap_integer(ts_node_start_byte(node));
+}
+
+/**
+ * Get the node's start position row and column.
+ */
+static Janet cfun_node_start_point(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  TSPoint point = ts_node_start_point(node);
+
+  Janet *tup = janet_tuple_begin(2);
+  tup[0] = janet_wrap_integer(point.row);
+  tup[1] = janet_wrap_integer(point.column);
+
+  return janet_wrap_tuple(janet_tuple_end(tup));
+}
+
+/**
+ * Get the node's end byte.
+ */
+static Janet cfun_node_end_byte(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  return janet_wrap_integer(ts_node_end_byte(node));
+}
+
+/**
+ * Get the node's end position row and column.
+ */
+static Janet cfun_node_end_point(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  TSPoint point = ts_node_end_point(node);
+
+  Janet *tup = janet_tuple_begin(2);
+  tup[0] = janet_wrap_integer(point.row);
+  tup[1] = janet_wrap_integer(point.column);
+
+  return janet_wrap_tuple(janet_tuple_end(tup));
+}
+
+/**
+ * Get an S-expression representing the node as a string.
+ *
+ * This string is allocated with `malloc` and the caller is responsible for
+ * freeing it using `free`.
+ */
+static Janet cfun_node_string(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  char *text = ts_node_string(node);
+  if (NULL == text) {
+    return janet_wrap_nil();
+  }
+
+  return janet_cstringv(text);
+}
+
+/**
+ * Check if the node is null. Functions like `ts_node_child` and
+ * `ts_node_next_sibling` will return a null node to indicate that no such node
+ * was found.
+ */
+static Janet cfun_node_is_null(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+
+  if (ts_node_is_null(node)) {
+    return janet_wrap_true();
+  }
+
+  return janet_wrap_false();
+}
+
+/**
+ * Check if the node is *named*. Named nodes correspond to named rules in the
+ * grammar, whereas *anonymous* nodes correspond to string literals in the
+ * grammar.
+ */
+static Janet cfun_node_is_named(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  if (ts_node_is_named(node)) {
+    return janet_wrap_true();
+  }
+
+  return janet_wrap_false();
+}
+
+/**
+ * Check if the node is a syntax error or contains any syntax errors.
+ */
+static Janet cfun_node_has_error(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  if (ts_node_has_error(node)) {
+    return janet_wrap_true();
+  }
+
+  return janet_wrap_false();
+}
+
+/**
+ * Get the node's immediate parent.
+ */
+static Janet cfun_node_parent(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSNode *node_p = jts_get_node(argv, 0);
+  TSNode node = node_p->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  return jts_wrap_node(ts_node_parent(node), node_p->tree);
+}
+
+/**
+ * Get the node's child at the given index, where zero represents the first
+ * child.
+ */
+static Janet cfun_node_child(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSNode *node_p = jts_get_node(argv, 0);
+  TSNode node = node_p->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  // XXX: how to handle negative appropriately?
+  uint32_t idx = (uint32_t)janet_getinteger(argv, 1);
+
+  return jts_wrap_node(ts_node_child(node, idx), node_p->tree);
+}
+
+// field id of the child at `idx`, found with a tree cursor so that it
+// agrees with `child` and `children`.  0 if the child has no field or
+// there is no such child.
+static TSFieldId jts_field_id_for_child(TSNode node, uint32_t idx) {
+  TSFieldId id = 0;
+
+  TSTreeCursor cursor = ts_tree_cursor_new(node);
+  if (ts_tree_cursor_goto_first_child(&cursor)) {
+    uint32_t i = 0;
+    while ((i < idx) && ts_tree_cursor_goto_next_sibling(&cursor)) {
+      i++;
+    }
+    if (i == idx) {
+      id = ts_tree_cursor_current_field_id(&cursor);
+    }
+  }
+  ts_tree_cursor_delete(&cursor);
+
+  return id;
+}
+
+/**
+ * Get the field name for node's child at the given index, where zero represents
+ * the first child. Returns NULL, if no field is found.
+ */
+static Janet cfun_node_field_name_for_child(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  uint32_t idx = (uint32_t)janet_getnat(argv, 1);
+
+  TSFieldId id = jts_field_id_for_child(node, idx);
+  if (0 == id) {
+    return janet_wrap_nil();
+  }
+
+  const char *name =
+    ts_language_field_name_for_id(ts_tree_language(node.tree), id);
+  if (NULL == name) {
+    return janet_wrap_nil();
+  }
+
+  return janet_cstringv(name);
+}
+
+/**
+ * Get the field id for node's child at the given index, or nil if the
+ * child has no field.  Unlike `field-name-for-child`, no string is
+ * created.
+ */
+static Janet cfun_node_field_id_for_child(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  uint32_t idx = (uint32_t)janet_getnat(argv, 1);
+
+  TSFieldId id = jts_field_id_for_child(node, idx);
+  if (0 == id) {
+    return janet_wrap_nil();
+  }
+
+  return janet_wrap_integer(id);
+}
+
+/**
+ * Get the node's number of children.
+ */
+static Janet cfun_node_child_count(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  // XXX: how to handle negative appropriately?
+  return janet_wrap_integer(ts_node_child_count(node));
+}
+
+/**
+ * Get the node's *named* child at the given index.
+ */
+static Janet cfun_node_named_child(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSNode *node_p = jts_get_node(argv, 0);
+  TSNode node = node_p->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  // XXX: how to handle negative appropriately?
+  uint32_t idx = (uint32_t)janet_getinteger(argv, 1);
+
+  return jts_wrap_node(ts_node_named_child(node, idx), node_p->tree);
+}
+
+/**
+ * Get the node's number of *named* children.
+ */
+static Janet cfun_node_named_child_count(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  // XXX: how to handle negative appropriately?
+  return janet_wrap_integer(ts_node_named_child_count(node));
+}
+
+/**
+ * Get the node's child with the given field name.
+ *
+ * The name may be a string, or a keyword, which is looked up in a
+ * table of the language's field ids built once per language.
+ */
+static Janet cfun_node_child_by_field_name(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSNode *node_p = jts_get_node(argv, 0);
+  TSNode node = node_p->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  if (janet_checktype(argv[1], JANET_KEYWORD)) {
+    TSFieldId id = jts_get_field_id(ts_tree_language(node.tree), argv, 1);
+    if (0 == id) {
+      return janet_wrap_nil();
+    }
+    return jts_wrap_node(ts_node_child_by_field_id(node, id), node_p->tree);
+  }
+
+  JanetByteView name = janet_getbytes(argv, 1);
+
+  return jts_wrap_node(ts_node_child_by_field_name(node,
+                                                   (const char *)name.bytes,
+                                                   (uint32_t)name.len),
+                       node_p->tree);
+}
+
+/**
+ * Get the node's child with the given numerical field id.
+ *
+ * You can convert a field name to an id using the
+ * `ts_language_field_id_for_name` function.
+ */
+static Janet cfun_node_child_by_field_id(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSNode *node_p = jts_get_node(argv, 0);
+  TSNode node = node_p->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  TSFieldId id = (TSFieldId)jts_get_symbol(argv, 1);
+  if (0 == id) {
+    return janet_wrap_nil();
+  }
+
+  return jts_wrap_node(ts_node_child_by_field_id(node, id), node_p->tree);
+}
+
+/**
+ * Get the node's next sibling.
+ */
+static Janet cfun_node_next_sibling(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSNode *node_p = jts_get_node(argv, 0);
+  TSNode node = node_p->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  return jts_wrap_node(ts_node_next_sibling(node), node_p->tree);
+}
+
+/**
+ * Get the node's previous sibling.
+ */
+static Janet cfun_node_prev_sibling(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSNode *node_p = jts_get_node(argv, 0);
+  TSNode node = node_p->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  return jts_wrap_node(ts_node_prev_sibling(node), node_p->tree);
+}
+
+/**
+ * Get the node's first child that extends beyond the given byte offset.
+ */
+static Janet cfun_node_first_child_for_byte(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSNode *node_p = jts_get_node(argv, 0);
+  TSNode node = node_p->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  // XXX: check for non-negative number?
+  uint32_t idx = (uint32_t)janet_getinteger(argv, 1);
+
+  return jts_wrap_node(ts_node_first_child_for_byte(node, idx), node_p->tree);
+}
+
+/**
+ * Get the node's first named child that extends beyond the given byte offset.
+ */
+static Janet cfun_node_first_named_child_for_byte(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSNode *node_p = jts_get_node(argv, 0);
+  TSNode node = node_p->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  // XXX: check for non-negative number?
+  uint32_t idx = (uint32_t)janet_getinteger(argv, 1);
+
+  return jts_wrap_node(ts_node_first_named_child_for_byte(node, idx),
+                       node_p->tree);
+}
+
+/**
+ * Get the smallest node within this node that spans the given range of bytes.
+ */
+static Janet cfun_node_descendant_for_byte_range(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 3);
+
+  JTSNode *node_p = jts_get_node(argv, 0);
+  TSNode node = node_p->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  uint32_t start = (uint32_t)janet_getinteger(argv, 1);
+  uint32_t end = (uint32_t)janet_getinteger(argv, 2);
+
+  return jts_wrap_node(ts_node_descendant_for_byte_range(node, start, end),
+                       node_p->tree);
+}
+
+/**
+ * Get the smallest node within this node that spans the given range of
+ * (row, column) positions.
+ */
+static Janet cfun_node_descendant_for_point_range(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 5);
+
+  JTSNode *node_p = jts_get_node(argv, 0);
+  TSNode node = node_p->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  uint32_t start_row = (uint32_t)janet_getinteger(argv, 1);
+  uint32_t start_col = (uint32_t)janet_getinteger(argv, 2);
+  uint32_t end_row = (uint32_t)janet_getinteger(argv, 3);
+  uint32_t end_col = (uint32_t)janet_getinteger(argv, 4);
+
+  TSPoint start_point = (TSPoint) {
+    start_row, start_col
+  };
+
+  TSPoint end_point = (TSPoint) {
+    end_row, end_col
+  };
+
+  return jts_wrap_node(ts_node_descendant_for_point_range(node, start_point,
+                                                           end_point),
+                       node_p->tree);
+}
+
+/**
+ * Check if two nodes are identical.
+ */
+static Janet cfun_node_eq(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  TSNode node_l = jts_get_node(argv, 0)->node;
+  if (ts_node_is_null(node_l)) {
+    return janet_wrap_nil();
+  }
+
+  TSNode node_r = jts_get_node(argv, 1)->node;
+  if (ts_node_is_null(node_r)) {
+    return janet_wrap_nil();
+  }
+
+  if (ts_node_eq(node_l, node_r)) {
+    return janet_wrap_true();
+  }
+
+  return janet_wrap_false();
+}
+
+static Janet cfun_node_tree(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSNode *node_p = jts_get_node(argv, 0);
+  if (ts_node_is_null(node_p->node)) {
+    return janet_wrap_nil();
+  }
+
+  // the tree the node was obtained from -- not a new owner of node.tree
+  return node_p->tree;
+}
+
+static Janet cfun_node_text(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 3);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  // strings, buffers, and file mappings all work, e.g. the same buffer
+  // given to parse-bytes or the `:source` of a tree from parse-file
+  JanetByteView source = jts_get_source(argv, 1);
+
+  // byte offset of the parsed text within `source`, for use with
+  // slices passed to parse-bytes
+  uint32_t offset = (uint32_t)janet_optnat(argv, argc, 2, 0);
+
+  uint32_t start = offset + ts_node_start_byte(node);
+  uint32_t end = offset + ts_node_end_byte(node);
+  if ((end < start) || (end > (uint32_t)source.len)) {
+    return janet_wrap_nil();
+  }
+
+  return janet_stringv(source.bytes + start, (int32_t)(end - start));
+}
+
+// `offset_n` is the index of the optional offset of the parsed text
+// within the source, as for a node's `:text`
+static void jts_search_args(int32_t argc, Janet *argv, TSNode node,
+                            int32_t offset_n, JTSSearchSpec **spec_pp,
+                            JanetByteView *source) {
+  JTSSearchSpec *spec = jts_get_search_spec(argv, 1);
+  if (spec->language != ts_tree_language(node.tree)) {
+    janet_panic("search spec is for a different language");
+  }
+
+  source->bytes = NULL;
+  source->len = 0;
+  if ((argc > 2) && !janet_checktype(argv[2], JANET_NIL)) {
+    *source = jts_source_from(jts_get_source(argv, 2),
+                              janet_optnat(argv, argc, offset_n, 0));
+  } else if (NULL != spec->text) {
+    janet_panic("source required to match :text");
+  }
+
+  *spec_pp = spec;
+}
+
+/**
+ * Find the first node in the subtree, in pre-order, that matches a
+ * compiled search spec (see `search-spec`), or nil.  The source
+ * (string, buffer, or file mapping) is needed for specs with `:text`,
+ * along with the offset of the parsed text within it for a tree parsed
+ * from a slice via parse-bytes.
+ *
+ * The walk is native and allocates only for the result.
+ */
+static Janet cfun_node_search(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 4);
+
+  JTSNode *node_p = jts_get_node(argv, 0);
+  TSNode node = node_p->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  JTSSearchSpec *spec = NULL;
+  JanetByteView source;
+  jts_search_args(argc, argv, node, 3, &spec, &source);
+
+  JanetArray *found = janet_array(1);
+  jts_search(spec, node, node_p->tree, source, found, 1);
+  if (0 == found->count) {
+    return janet_wrap_nil();
+  }
+
+  return found->data[0];
+}
+
+/**
+ * Find all nodes in the subtree, in pre-order, that match a compiled
+ * search spec, returning an array of at most `limit` (default: no
+ * limit) nodes.  The source and offset are as for `:search`.
+ */
+static Janet cfun_node_search_all(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 5);
+
+  JTSNode *node_p = jts_get_node(argv, 0);
+  TSNode node = node_p->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  JTSSearchSpec *spec = NULL;
+  JanetByteView source;
+  jts_search_args(argc, argv, node, 4, &spec, &source);
+
+  int32_t limit = janet_optnat(argv, argc, 3, INT32_MAX);
+
+  JanetArray *found = janet_array(0);
+  jts_search(spec, node, node_p->tree, source, found, limit);
+
+  return janet_wrap_array(found);
+}
+
+// output of write-s-expr goes to a buffer, or through a scratch buffer
+// to a file
+typedef struct {
+  JanetBuffer *buf;
+  FILE *file;
+  // errno of the first failed write to file, 0 if none
+  int error;
+} JTSWriter;
+
+static void jts_writer_flush(JTSWriter *w) {
+  if ((NULL != w->file) && (0 == w->error) && (w->buf->count > 0)) {
+    size_t len = (size_t)w->buf->count;
+    errno = 0;
+    if (fwrite(w->buf->data, 1, len, w->file) != len) {
+      w->error = (0 != errno) ? errno : EIO;
+    }
+    w->buf->count = 0;
+  }
+}
+
+static void jts_writer_puts(JTSWriter *w, const char *s) {
+  janet_buffer_push_cstring(w->buf, s);
+}
+
+/**
+ * Write the s-expression representation of the subtree at `node`, in
+ * the format of `print-s-expr`:
+ *
+ *   (type [start-row, start-col] - [end-row, end-col]
+ *
+ * per named node, children indented by two spaces per level and
+ * prefixed by their field name, if any.  With `byte_ranges`, each
+ * node's byte range follows as `{start, end}`.
+ */
+static void jts_write_s_expr(JTSWriter *w, TSNode node, int byte_ranges) {
+  TSTreeCursor cursor = ts_tree_cursor_new(node);
+
+  char nums[128];
+  int needs_nl = 0;
+  uint32_t indent_lvl = 0;
+  int visited_kids = 0;
+
+  while (1) {
+    TSNode current = ts_tree_cursor_current_node(&cursor);
+    int named = ts_node_is_named(current);
+    if (visited_kids) {
+      if (named) {
+        jts_writer_puts(w, ")");
+        needs_nl = 1;
+      }
+      if (ts_tree_cursor_goto_next_sibling(&cursor)) {
+        visited_kids = 0;
+      } else if ((indent_lvl > 0) && ts_tree_cursor_goto_parent(&cursor)) {
+        visited_kids = 1;
+        indent_lvl--;
+      } else {
+        break;
+      }
+    } else {
+      if (named) {
+        if (needs_nl) {
+          jts_writer_puts(w, "\n");
+          // a line is complete, a good point to hand off to the file
+          if (w->buf->count >= 65536) {
+            jts_writer_flush(w);
+            if (0 != w->error) {
+              break;
+            }
+          }
+        }
+        for (uint32_t i = 0; i < indent_lvl; i++) {
+          jts_writer_puts(w, "  ");
+        }
+        const char *field_name = ts_tree_cursor_current_field_name(&cursor);
+        if (NULL != field_name) {
+          jts_writer_puts(w, field_name);
+          jts_writer_puts(w, ": ");
+        }
+        jts_writer_puts(w, "(");
+        jts_writer_puts(w, ts_node_type(current));
+        TSPoint start = ts_node_start_point(current);
+        TSPoint end = ts_node_end_point(current);
+        if (byte_ranges) {
+          snprintf(nums, sizeof(nums), " [%u, %u] - [%u, %u] {%u, %u}",
+                   start.row, start.column, end.row, end.column,
+                   ts_node_start_byte(current), ts_node_end_byte(current));
+        } else {
+          snprintf(nums, sizeof(nums), " [%u, %u] - [%u, %u]",
+                   start.row, start.column, end.row, end.column);
+        }
+        jts_writer_puts(w, nums);
+        needs_nl = 1;
+      }
+      if (ts_tree_cursor_goto_first_child(&cursor)) {
+        visited_kids = 0;
+        indent_lvl++;
+      } else {
+        visited_kids = 1;
+      }
+    }
+  }
+  jts_writer_puts(w, "\n");
+
+  ts_tree_cursor_delete(&cursor);
+}
+
+/**
+ * Write the s-expression representation of the node's subtree (see
+ * `print-s-expr`) in one native pass.
+ *
+ * `dest` is a buffer to append to or a file to write to; if nil or
+ * omitted, a new buffer is used.  If `byte-ranges` is truthy, each
+ * node's byte range is included as `{start, end}`.  Returns `dest`.
+ */
+static Janet cfun_node_write_s_expr(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, 3);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  int byte_ranges = (argc > 2) && janet_truthy(argv[2]);
+
+  if ((argc < 2) || janet_checktype(argv[1], JANET_NIL)) {
+    JanetBuffer *buf = janet_buffer(1024);
+    JTSWriter w = {buf, NULL, 0};
+    jts_write_s_expr(&w, node, byte_ranges);
+    return janet_wrap_buffer(buf);
+  }
+
+  if (janet_checktype(argv[1], JANET_BUFFER)) {
+    JTSWriter w = {janet_unwrap_buffer(argv[1]), NULL, 0};
+    jts_write_s_expr(&w, node, byte_ranges);
+    return argv[1];
+  }
+
+  int32_t flags = 0;
+  FILE *file = janet_getfile(argv, 1, &flags);
+  if ((flags & JANET_FILE_CLOSED) ||
+      !(flags & (JANET_FILE_WRITE | JANET_FILE_APPEND | JANET_FILE_UPDATE))) {
+    janet_panicf("file is not writable: %v", argv[1]);
+  }
+
+  JanetBuffer scratch;
+  janet_buffer_init(&scratch, 65536 + 1024);
+  JTSWriter w = {&scratch, file, 0};
+  jts_write_s_expr(&w, node, byte_ranges);
+  jts_writer_flush(&w);
+  janet_buffer_deinit(&scratch);
+
+  // short writes may only show up once the file's own buffer is flushed
+  errno = 0;
+  if ((0 == w.error) && (0 != fflush(file))) {
+    w.error = (0 != errno) ? errno : EIO;
+  }
+  if (0 != w.error) {
+    janet_panicf("failed to write s-expression: %s", strerror(w.error));
+  }
+
+  return argv[1];
+}
+
+// append a packed node record to `buf`, as described for jts_children
+static void jts_push_node_record(JanetBuffer *buf, TSNode node,
+                                 TSFieldId field, int with_points) {
+  janet_buffer_extra(buf, (with_points ? 8 : 4) * (int32_t)sizeof(uint32_t));
+  janet_buffer_push_u32(buf, ts_node_symbol(node));
+  janet_buffer_push_u32(buf, field);
+  janet_buffer_push_u32(buf, ts_node_start_byte(node));
+  janet_buffer_push_u32(buf, ts_node_end_byte(node));
+  if (with_points) {
+    TSPoint start = ts_node_start_point(node);
+    TSPoint end = ts_node_end_point(node);
+    janet_buffer_push_u32(buf, start.row);
+    janet_buffer_push_u32(buf, start.column);
+    janet_buffer_push_u32(buf, end.row);
+    janet_buffer_push_u32(buf, end.column);
+  }
+}
+
+// which children jts_children collects
+#define JTS_CHILDREN_ALL 0
+#define JTS_CHILDREN_NAMED 1
+#define JTS_CHILDREN_FIELD 2
+
+/**
+ * Visit the children of `node` with a tree cursor, pushing those
+ * selected by `kind` (and `field`) to `found` as nodes, or if `buf` is
+ * non-NULL, appending them to `buf` as packed records of little-endian
+ * u32 values:
+ *
+ *   symbol, field id (0 for none), start byte, end byte
+ *
+ * followed, if `with_points` is set, by start row, start column, end
+ * row, and end column.  Returns the number of children collected.
+ */
+static int32_t jts_children(TSNode node, Janet tree, int kind,
+                            TSFieldId field, JanetArray *found,
+                            JanetBuffer *buf, int with_points) {
+  int32_t count = 0;
+
+  TSTreeCursor cursor = ts_tree_cursor_new(node);
+
+  if (ts_tree_cursor_goto_first_child(&cursor)) {
+    do {
+      TSNode child = ts_tree_cursor_current_node(&cursor);
+      TSFieldId child_field = ts_tree_cursor_current_field_id(&cursor);
+      if (((JTS_CHILDREN_NAMED == kind) && !ts_node_is_named(child)) ||
+          ((JTS_CHILDREN_FIELD == kind) && (child_field != field))) {
+        continue;
+      }
+
+      if (NULL == buf) {
+        janet_array_push(found, jts_wrap_node(child, tree));
+      } else {
+        jts_push_node_record(buf, child, child_field, with_points);
+      }
+      count++;
+    } while (ts_tree_cursor_goto_next_sibling(&cursor));
+  }
+
+  ts_tree_cursor_delete(&cursor);
+
+  return count;
+}
+
+// shared by children, named-children, and children-by-field, whose
+// optional buffer and with-points arguments start at `n`
+static Janet jts_children_method(int32_t argc, Janet *argv, int32_t n,
+                                 int kind, TSFieldId field) {
+  JTSNode *node_p = jts_get_node(argv, 0);
+  if (ts_node_is_null(node_p->node)) {
+    return janet_wrap_nil();
+  }
+
+  JanetBuffer *buf = NULL;
+  if ((argc > n) && !janet_checktype(argv[n], JANET_NIL)) {
+    buf = janet_getbuffer(argv, n);
+  }
+  int with_points = (argc > n + 1) && janet_truthy(argv[n + 1]);
+
+  JanetArray *found = NULL;
+  if (NULL == buf) {
+    found = janet_array((int32_t)ts_node_child_count(node_p->node));
+  }
+
+  // field id 0 stands for an unknown field name, which no child has
+  int32_t count = 0;
+  if ((JTS_CHILDREN_FIELD != kind) || (0 != field)) {
+    count = jts_children(node_p->node, node_p->tree, kind, field,
+                         found, buf, with_points);
+  }
+
+  if (NULL != buf) {
+    return janet_wrap_integer(count);
+  }
+
+  return janet_wrap_array(found);
+}
+
+/**
+ * Get all of the node's children in one pass, as an array of nodes, or
+ * if `buf` is given, as packed records appended to it (returning the
+ * number of records):  symbol, field id, start byte, and end byte as
+ * little-endian u32 values, followed by start row, start column, end
+ * row, and end column if `with-points` is truthy.
+ */
+static Janet cfun_node_children(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, 3);
+
+  return jts_children_method(argc, argv, 1, JTS_CHILDREN_ALL, 0);
+}
+
+/**
+ * As for `children`, but only the node's named children.
+ */
+static Janet cfun_node_named_children(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, 3);
+
+  return jts_children_method(argc, argv, 1, JTS_CHILDREN_NAMED, 0);
+}
+
+/**
+ * As for `children`, but only the node's children for `field`, given as
+ * a field id or name (see `child-by-field-name`).
+ */
+static Janet cfun_node_children_by_field(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 4);
+
+  TSNode node = jts_get_node(argv, 0)->node;
+  if (ts_node_is_null(node)) {
+    return janet_wrap_nil();
+  }
+
+  TSFieldId field = jts_get_field_id(ts_tree_language(node.tree), argv, 1);
+
+  return jts_children_method(argc, argv, 2, JTS_CHILDREN_FIELD, field);
+}
+
+static const JanetMethod node_methods[] = {
+  {"type", cfun_node_type},
+  {"symbol", cfun_node_symbol},
+  {"start-byte", cfun_node_start_byte},
+  {"start-point", cfun_node_start_point},
+  {"end-byte", cfun_node_end_byte},
+  {"end-point", cfun_node_end_point},
+  {"string", cfun_node_string},
+  {"is-null", cfun_node_is_null},
+  {"is-named", cfun_node_is_named},
+  //{"is-missing", cfun_node_is_missing},
+  //{"is-extra", cfun_node_is_extra},
+  //{"has-changes", cfun_node_has_changes},
+  {"has-error", cfun_node_has_error},
+  {"parent", cfun_node_parent},
+  {"child", cfun_node_child},
+  {"field-name-for-child", cfun_node_field_name_for_child},
+  {"child-count", cfun_node_child_count},
+  {"named-child", cfun_node_named_child},
+  {"named-child-count", cfun_node_named_child_count},
+  {"child-by-field-name", cfun_node_child_by_field_name},
+  {"child-by-field-id", cfun_node_child_by_field_id},
+  {"next-sibling", cfun_node_next_sibling},
+  {"prev-sibling", cfun_node_prev_sibling},
+  //{"next-named-sibling", cfun_node_next_named_sibling},
+  //{"prev-named-sibling", cfun_node_prev_named_sibling},
+  {"first-child-for-byte", cfun_node_first_child_for_byte},
+  {"first-named-child-for-byte", cfun_node_first_named_child_for_byte},
+  {"descendant-for-byte-range", cfun_node_descendant_for_byte_range},
+  {"descendant-for-point-range", cfun_node_descendant_for_point_range},
+  /*
+  {"named-descendant-for-byte-range",
+   cfun_node_named_descendant_for_byte_range},
+  {"named-descendant-for-point-range",
+   cfun_node_named_descendant_for_point_range},
+  */
+  //{"edit", cfun_node_edit}
+  {"eq", cfun_node_eq},
+  // custom
+  {"expr", cfun_node_string}, // alias for backward compatibility
+  {"tree", cfun_node_tree},
+  {"text", cfun_node_text},
+  {"write-s-expr", cfun_node_write_s_expr},
+  {"search", cfun_node_search},
+  {"search-all", cfun_node_search_all},
+  {"type-keyword", cfun_node_type_keyword},
+  {"children", cfun_node_children},
+  {"named-children", cfun_node_named_children},
+  {"children-by-field", cfun_node_children_by_field},
+  {"field-id-for-child", cfun_node_field_id_for_child},
+  {NULL, NULL}
+};
+
+static int jts_node_gcmark(void *p, size_t size) {
+  (void) size;
+
+  JTSNode *node_p = (JTSNode *)p;
+  janet_mark(node_p->tree);
+
+  return 0;
+}
+
+int jts_node_get(void *p, Janet key, Janet *out) {
+  (void) p;
+
+  if (!janet_checktype(key, JANET_KEYWORD)) {
+    return 0;
+  }
+
+  return janet_getmethod(janet_unwrap_keyword(key), node_methods, out);
+}
+
+////////
+
+static JTSNodeTable *jts_get_node_table(const Janet *argv, int32_t n) {
+  return (JTSNodeTable *)janet_getabstract(argv, n, &jts_node_table_type);
+}
+
+// returns 0 on success.  each array is grown in turn, so a failure part
+// way leaves every array at least at the old capacity.
+static int jts_node_table_reserve(JTSNodeTable *table, uint32_t capacity) {
+  if (capacity <= table->capacity) {
+    return 0;
+  }
+
+#define JTS_GROW(field, type) \
+  do { \
+    type *grown = (type *)realloc(table->field, sizeof(type) * capacity); \
+    if (NULL == grown) { \
+      return -1; \
+    } \
+    table->field = grown; \
+  } while (0)
+
+  JTS_GROW(symbols, TSSymbol);
+  JTS_GROW(parents, int32_t);
+  JTS_GROW(start_bytes, uint32_t);
+  JTS_GROW(end_bytes, uint32_t);
+  JTS_GROW(start_points, TSPoint);
+  JTS_GROW(end_points, TSPoint);
+  JTS_GROW(flags, uint8_t);
+
+#undef JTS_GROW
+
+  table->capacity = capacity;
+
+  return 0;
+}
+
+static int jts_node_table_push(JTSNodeTable *table, TSNode node,
+                               int32_t parent) {
+  if ((table->count == table->capacity) &&
+      (0 != jts_node_table_reserve(table, 2 * table->capacity))) {
+    return -1;
+  }
+
+  uint32_t i = table->count;
+  table->symbols[i] = ts_node_symbol(node);
+  table->parents[i] = parent;
+  table->start_bytes[i] = ts_node_start_byte(node);
+  table->end_bytes[i] = ts_node_end_byte(node);
+  table->start_points[i] = ts_node_start_point(node);
+  table->end_points[i] = ts_node_end_point(node);
+  table->flags[i] =
+    (ts_node_is_named(node) ? JTS_NODE_NAMED : 0) |
+    (ts_node_is_missing(node) ? JTS_NODE_MISSING : 0) |
+    (ts_node_is_extra(node) ? JTS_NODE_EXTRA : 0) |
+    (ts_node_has_error(node) ? JTS_NODE_HAS_ERROR : 0);
+  table->count++;
+
+  return 0;
+}
+
+/**
+ * Flatten the tree below `root` into a new node table with one
+ * pre-order pass of a tree cursor.
+ */
+static Janet jts_flatten(TSNode root) {
+  JTSNodeTable *table =
+    (JTSNodeTable *)janet_abstract(&jts_node_table_type,
+                                   sizeof(JTSNodeTable));
+  memset(table, 0, sizeof(JTSNodeTable));
+  table->language = ts_tree_language(root.tree);
+
+  // the table is owned by the gc from here on, so its arrays are freed
+  // even if a later allocation fails
+  Janet result = janet_wrap_abstract(table);
+
+  if (0 != jts_node_table_reserve(table, 256)) {
+    janet_panic("failed to allocate node table");
+  }
+
+  // parent index of each node on the cursor's path
+  int32_t stack_buf[64];
+  int32_t *stack = stack_buf;
+  uint32_t stack_capacity = 64;
+  uint32_t depth = 0;
+
+  TSTreeCursor cursor = ts_tree_cursor_new(root);
+
+  int32_t parent = -1;
+  int failed = 0;
+  int done = 0;
+  while (!done && !failed) {
+    if (0 != jts_node_table_push(table,
+                                 ts_tree_cursor_current_node(&cursor),
+                                 parent)) {
+      failed = 1;
+      break;
+    }
+
+    if (ts_tree_cursor_goto_first_child(&cursor)) {
+      if (depth == stack_capacity) {
+        uint32_t capacity = 2 * stack_capacity;
+        int32_t *grown = (int32_t *)malloc(sizeof(int32_t) * capacity);
+        if (NULL == grown) {
+          failed = 1;
+          break;
+        }
+        memcpy(grown, stack, sizeof(int32_t) * depth);
+        if (stack != stack_buf) {
+          free(stack);
+        }
+        stack = grown;
+        stack_capacity = capacity;
+      }
+      stack[depth++] = parent;
+      parent = (int32_t)(table->count - 1);
+      continue;
+    }
+
+    while (!ts_tree_cursor_goto_next_sibling(&cursor)) {
+      if ((0 == depth) || !ts_tree_cursor_goto_parent(&cursor)) {
+        done = 1;
+        break;
+      }
+      parent = stack[--depth];
+    }
+  }
+
+  ts_tree_cursor_delete(&cursor);
+  if (stack != stack_buf) {
+    free(stack);
+  }
+
+  if (failed) {
+    janet_panic("failed to grow node table");
+  }
+
+  return result;
+}
+
+static uint32_t jts_node_table_index(JTSNodeTable *table,
+                                     const Janet *argv, int32_t n) {
+  int32_t i = janet_getinteger(argv, n);
+  if ((i < 0) || ((uint32_t)i >= table->count)) {
+    janet_panicf("index %d out of range [0, %d)", i, (int32_t)table->count);
+  }
+
+  return (uint32_t)i;
+}
+
+static Janet jts_wrap_point(TSPoint point) {
+  Janet *tup = janet_tuple_begin(2);
+  tup[0] = janet_wrap_integer(point.row);
+  tup[1] = janet_wrap_integer(point.column);
+
+  return janet_wrap_tuple(janet_tuple_end(tup));
+}
+
+/**
+ * Get the number of nodes in the table.
+ */
+static Janet cfun_node_table_count(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSNodeTable *table = jts_get_node_table(argv, 0);
+
+  return janet_wrap_integer((int32_t)table->count);
+}
+
+/**
+ * Get the symbol id of the node at an index.
+ */
+static Janet cfun_node_table_symbol(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSNodeTable *table = jts_get_node_table(argv, 0);
+  uint32_t i = jts_node_table_index(table, argv, 1);
+
+  return janet_wrap_integer(table->symbols[i]);
+}
+
+/**
+ * Get the type of the node at an index.
+ */
+static Janet cfun_node_table_type(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSNodeTable *table = jts_get_node_table(argv, 0);
+  uint32_t i = jts_node_table_index(table, argv, 1);
+
+  const char *the_type =
+    ts_language_symbol_name(table->language, table->symbols[i]);
+  if (NULL == the_type) {
+    return janet_wrap_nil();
+  }
+
+  return janet_cstringv(the_type);
+}
+
+/**
+ * Get the index of the parent of the node at an index, or nil for the
+ * root.
+ */
+static Janet cfun_node_table_parent(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSNodeTable *table = jts_get_node_table(argv, 0);
+  uint32_t i = jts_node_table_index(table, argv, 1);
+
+  if (table->parents[i] < 0) {
+    return janet_wrap_nil();
+  }
+
+  return janet_wrap_integer(table->parents[i]);
+}
+
+static Janet cfun_node_table_start_byte(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSNodeTable *table = jts_get_node_table(argv, 0);
+  uint32_t i = jts_node_table_index(table, argv, 1);
+
+  return janet_wrap_integer(table->start_bytes[i]);
+}
+
+static Janet cfun_node_table_end_byte(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSNodeTable *table = jts_get_node_table(argv, 0);
+  uint32_t i = jts_node_table_index(table, argv, 1);
+
+  return janet_wrap_integer(table->end_bytes[i]);
+}
+
+static Janet cfun_node_table_start_point(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSNodeTable *table = jts_get_node_table(argv, 0);
+  uint32_t i = jts_node_table_index(table, argv, 1);
+
+  return jts_wrap_point(table->start_points[i]);
+}
+
+static Janet cfun_node_table_end_point(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSNodeTable *table = jts_get_node_table(argv, 0);
+  uint32_t i = jts_node_table_index(table, argv, 1);
+
+  return jts_wrap_point(table->end_points[i]);
+}
+
+/**
+ * Get the flag bits of the node at an index: 1 named, 2 missing,
+ * 4 extra, 8 has error.
+ */
+static Janet cfun_node_table_flags(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSNodeTable *table = jts_get_node_table(argv, 0);
+  uint32_t i = jts_node_table_index(table, argv, 1);
+
+  return janet_wrap_integer(table->flags[i]);
+}
+
+static Janet cfun_node_table_is_named(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSNodeTable *table = jts_get_node_table(argv, 0);
+  uint32_t i = jts_node_table_index(table, argv, 1);
+
+  return janet_wrap_boolean(table->flags[i] & JTS_NODE_NAMED);
+}
+
+/**
+ * Copy a whole column into a new buffer of little-endian u32 values, as
+ * in other packed records.
+ *
+ * Columns are `:symbol`, `:parent` (0xffffffff for the root),
+ * `:start-byte`, `:end-byte`, `:start-point` and `:end-point` (row,
+ * column pairs), and `:flags`.
+ */
+static Janet cfun_node_table_column(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSNodeTable *table = jts_get_node_table(argv, 0);
+  const uint8_t *name = janet_getkeyword(argv, 1);
+
+  int column = -1;
+  static const char *const names[] = {
+    "symbol", "parent", "start-byte", "end-byte",
+    "start-point", "end-point", "flags"
+  };
+  for (int j = 0; j < (int)(sizeof(names) / sizeof(names[0])); j++) {
+    if (0 == janet_cstrcmp(name, names[j])) {
+      column = j;
+      break;
+    }
+  }
+  if (column < 0) {
+    janet_panicf("unknown column: %v", argv[1]);
+  }
+
+  // points are two values per entry
+  uint64_t n_values = ((4 == column) || (5 == column)) ? 2 : 1;
+  if (n_values * sizeof(uint32_t) * table->count > INT32_MAX) {
+    janet_panic("column too large for a buffer");
+  }
+
+  int32_t len = (int32_t)(n_values * sizeof(uint32_t) * table->count);
+  JanetBuffer *buf = janet_buffer(len);
+  for (uint32_t i = 0; i < table->count; i++) {
+    switch (column) {
+      case 0:
+        janet_buffer_push_u32(buf, table->symbols[i]);
+        break;
+      case 1:
+        janet_buffer_push_u32(buf, (uint32_t)table->parents[i]);
+        break;
+      case 2:
+        janet_buffer_push_u32(buf, table->start_bytes[i]);
+        break;
+      case 3:
+        janet_buffer_push_u32(buf, table->end_bytes[i]);
+        break;
+      case 4:
+        janet_buffer_push_u32(buf, table->start_points[i].row);
+        janet_buffer_push_u32(buf, table->start_points[i].column);
+        break;
+      case 5:
+        janet_buffer_push_u32(buf, table->end_points[i].row);
+        janet_buffer_push_u32(buf, table->end_points[i].column);
+        break;
+      default:
+        janet_buffer_push_u32(buf, table->flags[i]);
+        break;
+    }
+  }
+
+  return janet_wrap_buffer(buf);
+}
+
+static const JanetMethod node_table_methods[] = {
+  {"count", cfun_node_table_count},
+  {"symbol", cfun_node_table_symbol},
+  {"type", cfun_node_table_type},
+  {"parent", cfun_node_table_parent},
+  {"start-byte", cfun_node_table_start_byte},
+  {"start-point", cfun_node_table_start_point},
+  {"end-byte", cfun_node_table_end_byte},
+  {"end-point", cfun_node_table_end_point},
+  {"flags", cfun_node_table_flags},
+  {"is-named", cfun_node_table_is_named},
+  {"column", cfun_node_table_column},
+  {NULL, NULL}
+};
+
+static int jts_node_table_gc(void *p, size_t size) {
+  (void) size;
+
+  JTSNodeTable *table = (JTSNodeTable *)p;
+  free(table->symbols);
+  free(table->parents);
+  free(table->start_bytes);
+  free(table->end_bytes);
+  free(table->start_points);
+  free(table->end_points);
+  free(table->flags);
+  memset(table, 0, sizeof(JTSNodeTable));
+
+  return 0;
+}
+
+static int jts_node_table_get(void *p, Janet key, Janet *out) {
+  (void) p;
+
+  if (!janet_checktype(key, JANET_KEYWORD)) {
+    return 0;
+  }
+
+  return janet_getmethod(janet_unwrap_keyword(key), node_table_methods, out);
+}
+
+////////
+
+static JTSTree *jts_get_tree(const Janet *argv, int32_t n) {
+  return (JTSTree *)janet_getabstract(argv, n, &jts_tree_type);
+}
+
+static Janet jts_wrap_tree(TSTree *tree, Janet source) {
+  JTSTree *tree_p =
+    (JTSTree *)janet_abstract(&jts_tree_type, sizeof(JTSTree));
+
+  tree_p->tree = tree;
+  tree_p->source = source;
+
+  return janet_wrap_abstract(tree_p);
+}
+
+/**
+ * Get the root node of the syntax tree.
+ */
+static Janet cfun_tree_root_node(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSTree *tree_p = jts_get_tree(argv, 0);
+  // XXX: error checking?
+
+  return jts_wrap_node(ts_tree_root_node(tree_p->tree), argv[0]);
+}
+
+/**
+ * Edit the syntax tree to keep it in sync with source code that has been
+ * edited.
+ *
+ * You must describe the edit both in terms of byte offsets and in terms of
+ * (row, column) coordinates.
+ */
+static Janet cfun_tree_edit(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 10);
+
+  JTSTree *tree_p = jts_get_tree(argv, 0);
+  // XXX: error checking?
+
+  uint32_t start_byte = janet_getinteger(argv, 1);
+  uint32_t old_end_byte = janet_getinteger(argv, 2);
+  uint32_t new_end_byte = janet_getinteger(argv, 3);
+  TSPoint start_point = (TSPoint) {
+    (uint32_t)janet_getinteger(argv, 4),
+    (uint32_t)janet_getinteger(argv, 5)
+  };
+  TSPoint old_end_point = (TSPoint) {
+    (uint32_t)janet_getinteger(argv, 6),
+    (uint32_t)janet_getinteger(argv, 7)
+  };
+  TSPoint new_end_point = (TSPoint) {
+    (uint32_t)janet_getinteger(argv, 8),
+    (uint32_t)janet_getinteger(argv, 9)
+  };
+
+  TSInputEdit input_edit = (TSInputEdit) {
+    .start_byte = start_byte,
+    .old_end_byte = old_end_byte,
+    .new_end_byte = new_end_byte,
+    .start_point = start_point,
+    .old_end_point = old_end_point,
+    .new_end_point = new_end_point
+  };
+
+  ts_tree_edit(tree_p->tree, &input_edit);
+
+  return janet_wrap_nil();
+}
+
+// number of unsigned 32-bit integers per packed edit, in the same
+// order as the arguments to edit
+#define JTS_EDIT_FIELDS 9
+
+typedef struct {
+  TSInputEdit edit;
+  int32_t index;
+} JTSIndexedEdit;
+
+static int jts_compare_edits_desc(const void *a, const void *b) {
+  const JTSIndexedEdit *ea = (const JTSIndexedEdit *)a;
+  const JTSIndexedEdit *eb = (const JTSIndexedEdit *)b;
+
+  if (ea->edit.start_byte != eb->edit.start_byte) {
+    return (ea->edit.start_byte < eb->edit.start_byte) ? 1 : -1;
+  }
+
+  // at the same start, insertions come before the text of any other
+  // edit, so that edit is applied first
+  int ea_inserts = (ea->edit.old_end_byte == ea->edit.start_byte);
+  int eb_inserts = (eb->edit.old_end_byte == eb->edit.start_byte);
+  if (ea_inserts != eb_inserts) {
+    return ea_inserts ? 1 : -1;
+  }
+
+  return (ea->index < eb->index) ? 1 : -1;
+}
+
+// packed records, read and written, hold little-endian u32 values
+static uint32_t jts_read_u32_le(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static TSInputEdit jts_edit_from_fields(const uint32_t *f) {
+  return (TSInputEdit) {
+    .start_byte = f[0],
+    .old_end_byte = f[1],
+    .new_end_byte = f[2],
+    .start_point = (TSPoint) {
+      f[3], f[4]
+    },
+    .old_end_point = (TSPoint) {
+      f[5], f[6]
+    },
+    .new_end_point = (TSPoint) {
+      f[7], f[8]
+    }
+  };
+}
+
+/**
+ * Apply many edits to the syntax tree in one call.
+ *
+ * `edits` is either an array / tuple whose elements are each an
+ * array / tuple of 9 integers (the same values, in the same order, as
+ * the arguments to edit), or a buffer of packed edits, each made of 9
+ * little-endian unsigned 32-bit integers, as in the packed records
+ * other functions produce.
+ *
+ * All edits are described in terms of the text *before* any of them
+ * were made (e.g. one edit per cursor) and must not overlap.  They are
+ * applied from the end of the document backwards so no edit shifts the
+ * coordinates of another.  Insertions at the same position end up in
+ * the order given, ahead of a replacement or deletion starting there.
+ * Whether a batch is accepted does not depend on the order of its
+ * edits.  Afterwards, a single reparse brings the tree up to date.
+ *
+ * Returns the number of edits applied.
+ */
+static Janet cfun_tree_edit_batch(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSTree *tree_p = jts_get_tree(argv, 0);
+
+  int32_t count = 0;
+  JTSIndexedEdit *edits = NULL;
+
+  if (janet_checktype(argv[1], JANET_BUFFER)) {
+    JanetBuffer *buf = janet_unwrap_buffer(argv[1]);
+    size_t rec_size = sizeof(uint32_t) * JTS_EDIT_FIELDS;
+    if (0 != (buf->count % rec_size)) {
+      janet_panicf("buffer length %d is not a multiple of %d",
+                   buf->count, (int32_t)rec_size);
+    }
+    count = (int32_t)(buf->count / rec_size);
+    edits = (JTSIndexedEdit *)malloc(sizeof(JTSIndexedEdit) * (count + 1));
+    if (NULL == edits) {
+      janet_panic("failed to allocate edits");
+    }
+    for (int32_t i = 0; i < count; i++) {
+      const uint8_t *rec = buf->data + i * rec_size;
+      uint32_t f[JTS_EDIT_FIELDS];
+      for (int32_t j = 0; j < JTS_EDIT_FIELDS; j++) {
+        f[j] = jts_read_u32_le(rec + j * sizeof(uint32_t));
+      }
+      edits[i].edit = jts_edit_from_fields(f);
+      edits[i].index = i;
+    }
+  } else {
+    JanetView view = janet_getindexed(argv, 1);
+    count = view.len;
+    edits = (JTSIndexedEdit *)malloc(sizeof(JTSIndexedEdit) * (count + 1));
+    if (NULL == edits) {
+      janet_panic("failed to allocate edits");
+    }
+    for (int32_t i = 0; i < count; i++) {
+      const Janet *items = NULL;
+      int32_t len = 0;
+      if (!janet_indexed_view(view.items[i], &items, &len) ||
+          (JTS_EDIT_FIELDS != len)) {
+        free(edits);
+        janet_panicf("edit %d: expected %d integers, got %v",
+                     i, JTS_EDIT_FIELDS, view.items[i]);
+      }
+      uint32_t f[JTS_EDIT_FIELDS];
+      for (int32_t j = 0; j < JTS_EDIT_FIELDS; j++) {
+        if (!janet_checkint(items[j]) ||
+            (janet_unwrap_integer(items[j]) < 0)) {
+          free(edits);
+          janet_panicf("edit %d: expected non-negative integer, got %v",
+                       i, items[j]);
+        }
+        f[j] = (uint32_t)janet_unwrap_integer(items[j]);
+      }
+      edits[i].edit = jts_edit_from_fields(f);
+      edits[i].index = i;
+    }
+  }
+
+  qsort(edits, (size_t)count, sizeof(JTSIndexedEdit), jts_compare_edits_desc);
+
+  for (int32_t i = 0; i < count; i++) {
+    TSInputEdit *e = &edits[i].edit;
+    if ((e->old_end_byte < e->start_byte) ||
+        (e->new_end_byte < e->start_byte) ||
+        ((i > 0) && (e->old_end_byte > edits[i - 1].edit.start_byte))) {
+      int32_t index = edits[i].index;
+      free(edits);
+      janet_panicf("edit %d is malformed or overlaps another edit", index);
+    }
+  }
+
+  for (int32_t i = 0; i < count; i++) {
+    ts_tree_edit(tree_p->tree, &edits[i].edit);
+  }
+
+  free(edits);
+
+  return janet_wrap_integer(count);
+}
+
+/**
+ * Compare an old edited syntax tree to a new syntax tree representing the same
+ * document, returning an array of ranges whose syntactic structure has changed.
+ *
+ * For this to work correctly, the old syntax tree must have been edited such
+ * that its ranges match up to the new tree. Generally, you'll want to call
+ * this function right after calling one of the `ts_parser_parse` functions.
+ * You need to pass the old tree that was passed to parse, as well as the new
+ * tree that was returned from that function.
+ *
+ * The returned array is allocated using `malloc` and the caller is responsible
+ * for freeing it using `free`. The length of the array will be written to the
+ * given `length` pointer.
+ */
+static Janet cfun_tree_get_changed_ranges(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSTree *old_tree_p = jts_get_tree(argv, 0);
+  JTSTree *new_tree_p = jts_get_tree(argv, 1);
+  // XXX: error checking?
+
+  uint32_t length = 0;
+
+  TSRange *range =
+    ts_tree_get_changed_ranges(old_tree_p->tree, new_tree_p->tree, &length);
+
+  if (length == 0) {
+    free(range);
+    return janet_wrap_nil();
+  }
+
+  Janet *ranges = janet_tuple_begin((int32_t)length);
+
+  for (int i = 0; i < length; i++) {
+    Janet *tup = janet_tuple_begin(6);
+    tup[0] = janet_wrap_integer(range[i].start_byte);
+    tup[1] = janet_wrap_integer(range[i].end_byte);
+    tup[2] = janet_wrap_integer(range[i].start_point.row);
+    tup[3] = janet_wrap_integer(range[i].start_point.column);
+    tup[4] = janet_wrap_integer(range[i].end_point.row);
+    tup[5] = janet_wrap_integer(range[i].end_point.column);
+    ranges[i] = janet_wrap_tuple(janet_tuple_end(tup));
+  }
+
+  free(range);
+
+  return janet_wrap_tuple(janet_tuple_end(ranges));
+}
+
+// kinds of change reported by diff
+#define JTS_DIFF_ADDED 0
+#define JTS_DIFF_REMOVED 1
+#define JTS_DIFF_CHANGED 2
+#define JTS_DIFF_MOVED 3
+
+typedef struct {
+  TSNode node;
+  uint32_t symbol;
+  uint32_t start;
+  uint32_t end;
+  // change kind, or -1 while undecided / unchanged
+  int32_t kind;
+  int matched;
+  // leaves may be inline subtrees, whose id is made from their symbol
+  // and size rather than an address, so it does not identify them
+  int leaf;
+} JTSDiffEntry;
+
+typedef struct {
+  JTSDiffEntry *items;
+  uint32_t count;
+  uint32_t capacity;
+} JTSDiffEntries;
+
+static int jts_diff_entries_push(JTSDiffEntries *es, TSNode node) {
+  if (es->count == es->capacity) {
+    uint32_t capacity = (0 == es->capacity) ? 64 : 2 * es->capacity;
+    JTSDiffEntry *items =
+      (JTSDiffEntry *)realloc(es->items, capacity * sizeof(JTSDiffEntry));
+    if (NULL == items) {
+      return -1;
+    }
+    es->items = items;
+    es->capacity = capacity;
+  }
+
+  JTSDiffEntry *e = &es->items[es->count++];
+  e->node = node;
+  e->symbol = ts_node_symbol(node);
+  e->start = ts_node_start_byte(node);
+  e->end = ts_node_end_byte(node);
+  e->kind = -1;
+  e->matched = 0;
+  e->leaf = (0 == ts_node_child_count(node));
+
+  return 0;
+}
+
+static int jts_diff_intersects(const TSRange *ranges, uint32_t n_ranges,
+                               uint32_t start, uint32_t end) {
+  // inclusive, so nodes touching a range are looked at too -- unchanged
+  // ones are filtered out by identity afterwards
+  for (uint32_t i = 0; i < n_ranges; i++) {
+    if ((start <= ranges[i].end_byte) && (end >= ranges[i].start_byte)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// collect the named nodes of `tree` intersecting `ranges` in pre-order,
+// skipping subtrees outside all of them.  returns 0 on success.
+static int jts_diff_collect(TSTree *tree, const TSRange *ranges,
+                            uint32_t n_ranges, JTSDiffEntries *es) {
+  TSTreeCursor cursor = ts_tree_cursor_new(ts_tree_root_node(tree));
+
+  int err = 0;
+  uint32_t depth = 0;
+  while (1) {
+    TSNode node = ts_tree_cursor_current_node(&cursor);
+    int hit = jts_diff_intersects(ranges, n_ranges,
+                                  ts_node_start_byte(node),
+                                  ts_node_end_byte(node));
+    if (hit && ts_node_is_named(node) &&
+        (0 != jts_diff_entries_push(es, node))) {
+      err = -1;
+      break;
+    }
+
+    if (hit && ts_tree_cursor_goto_first_child(&cursor)) {
+      depth++;
+      continue;
+    }
+
+    int done = 0;
+    while (!ts_tree_cursor_goto_next_sibling(&cursor)) {
+      if ((0 == depth) || !ts_tree_cursor_goto_parent(&cursor)) {
+        done = 1;
+        break;
+      }
+      depth--;
+    }
+    if (done) {
+      break;
+    }
+  }
+
+  ts_tree_cursor_delete(&cursor);
+
+  return err;
+}
+
+static int jts_diff_cmp_id(const void *a, const void *b) {
+  uintptr_t l = (uintptr_t)((const JTSDiffEntry *)a)->node.id;
+  uintptr_t r = (uintptr_t)((const JTSDiffEntry *)b)->node.id;
+  return (l < r) ? -1 : ((l > r) ? 1 : 0);
+}
+
+static int jts_diff_cmp_position(const void *a, const void *b) {
+  const JTSDiffEntry *l = (const JTSDiffEntry *)a;
+  const JTSDiffEntry *r = (const JTSDiffEntry *)b;
+  if (l->start != r->start) {
+    return (l->start < r->start) ? -1 : 1;
+  }
+  if (l->symbol != r->symbol) {
+    return (l->symbol < r->symbol) ? -1 : 1;
+  }
+  return 0;
+}
+
+static JTSDiffEntry *jts_diff_find_id(JTSDiffEntries *es, const void *id) {
+  uint32_t lo = 0;
+  uint32_t hi = es->count;
+  while (lo < hi) {
+    uint32_t mid = lo + ((hi - lo) / 2);
+    uintptr_t mid_id = (uintptr_t)es->items[mid].node.id;
+    if (mid_id == (uintptr_t)id) {
+      return &es->items[mid];
+    } else if (mid_id < (uintptr_t)id) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return NULL;
+}
+
+// first unmatched entry with the given start and symbol, with `es`
+// sorted by jts_diff_cmp_position
+static JTSDiffEntry *jts_diff_find_position(JTSDiffEntries *es,
+                                            uint32_t start,
+                                            uint32_t symbol) {
+  JTSDiffEntry key;
+  key.start = start;
+  key.symbol = symbol;
+
+  uint32_t lo = 0;
+  uint32_t hi = es->count;
+  while (lo < hi) {
+    uint32_t mid = lo + ((hi - lo) / 2);
+    if (jts_diff_cmp_position(&es->items[mid], &key) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  for (uint32_t i = lo; i < es->count; i++) {
+    if (0 != jts_diff_cmp_position(&es->items[i], &key)) {
+      break;
+    }
+    if (!es->items[i].matched) {
+      return &es->items[i];
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Classify the changed named nodes between `old_es` (from the edited old
+ * tree) and `new_es`.  A new node with children that is the very same
+ * subtree as an old one (tree-sitter reused it) is unchanged if it did
+ * not shift, and moved otherwise.  A new leaf is unchanged if an old
+ * leaf of the same type had the same extent and was not touched by an
+ * edit.  Remaining new nodes are changed if an old node of the same type
+ * started at the same position, else added; remaining old nodes are
+ * removed.  Leaves `old_es` sorted by position.
+ */
+static void jts_diff_classify(JTSDiffEntries *old_es,
+                              JTSDiffEntries *new_es) {
+  qsort(old_es->items, old_es->count, sizeof(JTSDiffEntry),
+        jts_diff_cmp_id);
+
+  for (uint32_t i = 0; i < new_es->count; i++) {
+    JTSDiffEntry *ne = &new_es->items[i];
+    if (ne->leaf) {
+      continue;
+    }
+    JTSDiffEntry *oe = jts_diff_find_id(old_es, ne->node.id);
+    if ((NULL == oe) || oe->leaf) {
+      continue;
+    }
+    oe->matched = 1;
+    ne->matched = 1;
+    if ((oe->start != ne->start) || (oe->end != ne->end)) {
+      ne->kind = JTS_DIFF_MOVED;
+    }
+  }
+
+  qsort(old_es->items, old_es->count, sizeof(JTSDiffEntry),
+        jts_diff_cmp_position);
+
+  for (uint32_t i = 0; i < new_es->count; i++) {
+    JTSDiffEntry *ne = &new_es->items[i];
+    if (ne->matched) {
+      continue;
+    }
+    JTSDiffEntry *oe = jts_diff_find_position(old_es, ne->start, ne->symbol);
+    if (NULL == oe) {
+      ne->kind = JTS_DIFF_ADDED;
+      continue;
+    }
+    oe->matched = 1;
+    ne->matched = 1;
+    // an edited old leaf has changes, even if the new text is the same
+    // length (e.g. a renamed symbol)
+    if (!(ne->leaf && oe->leaf &&
+          (oe->end == ne->end) &&
+          !ts_node_has_changes(oe->node))) {
+      ne->kind = JTS_DIFF_CHANGED;
+    }
+  }
+
+  for (uint32_t i = 0; i < old_es->count; i++) {
+    if (!old_es->items[i].matched) {
+      old_es->items[i].kind = JTS_DIFF_REMOVED;
+    }
+  }
+}
+
+static void jts_diff_push_record(JanetBuffer *buf, const JTSDiffEntry *e,
+                                 int with_points) {
+  janet_buffer_extra(buf, (with_points ? 8 : 4) * (int32_t)sizeof(uint32_t));
+  janet_buffer_push_u32(buf, (uint32_t)e->kind);
+  janet_buffer_push_u32(buf, e->symbol);
+  janet_buffer_push_u32(buf, e->start);
+  janet_buffer_push_u32(buf, e->end);
+  if (with_points) {
+    TSPoint start = ts_node_start_point(e->node);
+    TSPoint end = ts_node_end_point(e->node);
+    janet_buffer_push_u32(buf, start.row);
+    janet_buffer_push_u32(buf, start.column);
+    janet_buffer_push_u32(buf, end.row);
+    janet_buffer_push_u32(buf, end.column);
+  }
+}
+
+static Janet jts_diff_kind_keyword(int32_t kind) {
+  switch (kind) {
+    case JTS_DIFF_ADDED:
+      return janet_ckeywordv("added");
+    case JTS_DIFF_REMOVED:
+      return janet_ckeywordv("removed");
+    case JTS_DIFF_CHANGED:
+      return janet_ckeywordv("changed");
+    default:
+      return janet_ckeywordv("moved");
+  }
+}
+
+/**
+ * Report the named nodes that changed between `old-tree` (edited to
+ * match the new text, as for `get-changed-ranges`) and `new-tree`,
+ * looking only within the changed ranges.
+ *
+ * Returns an array of `[kind node]` tuples, where kind is one of
+ * `:added`, `:changed`, `:moved` (nodes of the new tree), or `:removed`
+ * (nodes of the old tree).  New-tree nodes come first, in pre-order,
+ * followed by removed nodes ordered by start byte.
+ *
+ * If `buf` is given, packed records of little-endian u32 values are
+ * appended to it instead and their number is returned:
+ *
+ *   kind (0 added, 1 removed, 2 changed, 3 moved), symbol, start byte,
+ *   end byte
+ *
+ * followed by start row, start column, end row, and end column if
+ * `with-points` is truthy.
+ */
+static Janet cfun_tree_diff(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 4);
+
+  JTSTree *old_tree_p = jts_get_tree(argv, 0);
+  JTSTree *new_tree_p = jts_get_tree(argv, 1);
+
+  JanetBuffer *buf = NULL;
+  if ((argc > 2) && !janet_checktype(argv[2], JANET_NIL)) {
+    buf = janet_getbuffer(argv, 2);
+  }
+  int with_points = (argc > 3) && janet_truthy(argv[3]);
+
+  uint32_t n_ranges = 0;
+  TSRange *ranges =
+    ts_tree_get_changed_ranges(old_tree_p->tree, new_tree_p->tree,
+                               &n_ranges);
+
+  JTSDiffEntries old_es = {NULL, 0, 0};
+  JTSDiffEntries new_es = {NULL, 0, 0};
+
+  int err = 0;
+  if (n_ranges > 0) {
+    err = jts_diff_collect(old_tree_p->tree, ranges, n_ranges, &old_es) ||
+          jts_diff_collect(new_tree_p->tree, ranges, n_ranges, &new_es);
+  }
+  free(ranges);
+
+  if (err) {
+    free(old_es.items);
+    free(new_es.items);
+    janet_panic("out of memory while diffing trees");
+  }
+
+  if (n_ranges > 0) {
+    jts_diff_classify(&old_es, &new_es);
+  }
+
+  int32_t count = 0;
+  JanetArray *changes = (NULL == buf) ? janet_array(0) : NULL;
+  for (int side = 0; side < 2; side++) {
+    JTSDiffEntries *es = (0 == side) ? &new_es : &old_es;
+    Janet tree = (0 == side) ? argv[1] : argv[0];
+    for (uint32_t i = 0; i < es->count; i++) {
+      JTSDiffEntry *e = &es->items[i];
+      if (e->kind < 0) {
+        continue;
+      }
+      if (NULL != buf) {
+        jts_diff_push_record(buf, e, with_points);
+      } else {
+        Janet *tup = janet_tuple_begin(2);
+        tup[0] = jts_diff_kind_keyword(e->kind);
+        tup[1] = jts_wrap_node(e->node, tree);
+        janet_array_push(changes, janet_wrap_tuple(janet_tuple_end(tup)));
+      }
+      count++;
+    }
+  }
+
+  free(old_es.items);
+  free(new_es.items);
+
+  if (NULL != buf) {
+    return janet_wrap_integer(count);
+  }
+
+  return janet_wrap_array(changes);
+}
+
+/**
+ * Write a DOT graph describing the syntax tree to the given file.
+ */
+static Janet cfun_tree_print_dot_graph(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSTree *tree_p = jts_get_tree(argv, 0);
+  // XXX: error checking?
+
+  // XXX: is this safe?
+  JanetFile *of =
+    (JanetFile *)janet_getabstract(argv, 1, &janet_file_type);
+
+  // XXX: check of->flags to make sure writable?
+  //      what about append, etc.?
+  if (!(of->flags & JANET_FILE_WRITE)) {
+    return janet_wrap_nil();
+  }
+
+  ts_tree_print_dot_graph(tree_p->tree, of->file);
+
+  return janet_wrap_nil();
+}
+
+/**
+ * Flatten the whole tree into a node table: one native pre-order pass
+ * recording each node's symbol, parent index, byte range, points, and
+ * flags in parallel arrays, without allocating a Janet value per node.
+ */
+static Janet cfun_tree_flatten(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSTree *tree_p = jts_get_tree(argv, 0);
+
+  return jts_flatten(ts_tree_root_node(tree_p->tree));
+}
+
+/**
+ * Create a shallow copy of the syntax tree. This is very fast.
+ *
+ * You need to copy a syntax tree in order to use it on more than one thread
+ * at a time, as syntax trees are not thread safe.  The copy keeps the same
+ * source.
+ */
+static Janet cfun_tree_copy(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSTree *tree_p = jts_get_tree(argv, 0);
+
+  return jts_wrap_tree(ts_tree_copy(tree_p->tree), tree_p->source);
+}
+
+/**
+ * Get the source the tree keeps alive, e.g. the file mapping of a tree
+ * from `parse-file`, or nil.
+ */
+static Janet cfun_tree_source(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSTree *tree_p = jts_get_tree(argv, 0);
+
+  return tree_p->source;
+}
+
+static const JanetMethod tree_methods[] = {
+  {"copy", cfun_tree_copy},
+  //{"delete", cfun_tree_delete},
+  {"root-node", cfun_tree_root_node},
+  //{"root-node-with-offset", cfun_tree_root_node_with_offset},
+  //{"language", cfun_tree_language},
+  //{"included-ranges", cfun_tree_included_ranges},
+  {"edit", cfun_tree_edit},
+  {"get-changed-ranges", cfun_tree_get_changed_ranges},
+  {"print-dot-graph", cfun_tree_print_dot_graph},
+  // custom
+  {"edit-batch", cfun_tree_edit_batch},
+  {"flatten", cfun_tree_flatten},
+  {"source", cfun_tree_source},
+  {"diff", cfun_tree_diff},
+  {NULL, NULL}
+};
+
+static int jts_tree_gc(void *p, size_t size) {
+  (void) size;
+
+  JTSTree *tree_p = (JTSTree *)p;
+  if (tree_p->tree != NULL) {
+    ts_tree_delete(tree_p->tree);
+    tree_p->tree = NULL;
+  }
+
+  return 0;
+}
+
+static int jts_tree_gcmark(void *p, size_t size) {
+  (void) size;
+
+  JTSTree *tree_p = (JTSTree *)p;
+  janet_mark(tree_p->source);
+
+  return 0;
+}
+
+static int jts_tree_get(void *p, Janet key, Janet *out) {
+  (void) p;
+
+  if (!janet_checktype(key, JANET_KEYWORD)) {
+    return 0;
+  }
+
+  return janet_getmethod(janet_unwrap_keyword(key), tree_methods, out);
+}
+
+// marshaling hands a fresh ts_tree_copy to the receiver, so the sender
+// may keep editing its own tree.  only meaningful within one process,
+// e.g. when sending a tree to another janet thread.  the source goes
+// along with it (strings and buffers are copied, mappings are shared).
+
+static void jts_tree_marshal(void *p, JanetMarshalContext *ctx) {
+  JTSTree *tree_p = (JTSTree *)p;
+
+  jts_marshal_check_unsafe(ctx, "tree");
+  janet_marshal_abstract(ctx, p);
+  janet_marshal_ptr(ctx, ts_tree_copy(tree_p->tree));
+  janet_marshal_janet(ctx, tree_p->source);
+}
+
+static void *jts_tree_unmarshal(JanetMarshalContext *ctx) {
+  JTSTree *tree_p =
+    (JTSTree *)janet_unmarshal_abstract(ctx, sizeof(JTSTree));
+
+  tree_p->tree = NULL;
+  tree_p->source = janet_wrap_nil();
+
+  tree_p->tree = (TSTree *)janet_unmarshal_ptr(ctx);
+  tree_p->source = janet_unmarshal_janet(ctx);
+
+  return tree_p;
+}
+
+////////
+
+static JTSParser *jts_get_parser(const Janet *argv, int32_t n) {
+  JTSParser *parser_p =
+    (JTSParser *)janet_getabstract(argv, n, &jts_parser_type);
+  if (NULL == parser_p->parser) {
+    janet_panic("parser is unusable (e.g. released to a parser pool)");
+  }
+
+  return parser_p;
+}
+
+/**
+ * Set the language that the parser should use for parsing.
+ *
+ * Returns a boolean indicating whether or not the language was successfully
+ * assigned. True means assignment succeeded. False means there was a version
+ * mismatch: the language was generated with an incompatible version of the
+ * Tree-sitter CLI.
+ */
+static Janet cfun_parser_set_language(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSParser *parser_p = jts_get_parser(argv, 0);
+  TSLanguage **lang_pp = jts_get_language(argv, 1);
+
+  return janet_wrap_boolean(ts_parser_set_language(parser_p->parser,
+                                                   *lang_pp));
+}
+
+/**
+ * Get the parser's current language.
+ */
+static Janet cfun_parser_language(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSParser *parser_p = jts_get_parser(argv, 0);
+
+  const TSLanguage *lang = ts_parser_language(parser_p->parser);
+  if (NULL == lang) {
+    return janet_wrap_nil();
+  }
+
+  return jts_wrap_language(lang);
+}
+
+// lines passed to parse are indexed once up front:  offsets[i] is the
+// byte index at which line i starts and offsets[count] is the total
+// length.  the read callback can then locate any byte index by binary
+// search and hand out a pointer into the line's own memory.
+
+typedef struct {
+  int32_t count;
+  const uint8_t **data;
+  uint32_t *offsets;
+  int32_t last_row;
+} JTSLineTable;
+
+static void jts_line_table_init(JTSLineTable *table, JanetArray *lines) {
+  table->count = lines->count;
+  table->last_row = 0;
+  table->data =
+    (const uint8_t **)malloc(sizeof(uint8_t *) * (lines->count + 1));
+  table->offsets =
+    (uint32_t *)malloc(sizeof(uint32_t) * (lines->count + 1));
+  if ((NULL == table->data) || (NULL == table->offsets)) {
+    free(table->data);
+    free(table->offsets);
+    janet_panic("failed to allocate line table");
+  }
+
+  uint32_t total = 0;
+  for (int32_t i = 0; i < lines->count; i++) {
+    const uint8_t *bytes = NULL;
+    int32_t len = 0;
+    // strings, buffers, keywords, and symbols are all fine
+    if (!janet_bytes_view(lines->data[i], &bytes, &len)) {
+      free(table->data);
+      free(table->offsets);
+      janet_panicf("expected buffer or string for line %d, got %v",
+                   i, lines->data[i]);
+    }
+    table->data[i] = bytes;
+    table->offsets[i] = total;
+    total += (uint32_t)len;
+  }
+  table->offsets[lines->count] = total;
+}
+
+static void jts_line_table_deinit(JTSLineTable *table) {
+  free(table->data);
+  free(table->offsets);
+  table->data = NULL;
+  table->offsets = NULL;
+}
+
+static const char *jts_read_lines_fn(void *payload,
+                                     uint32_t byte_index,
+                                     TSPoint position,
+                                     uint32_t *bytes_read) {
+  (void)position;
+  JTSLineTable *table = (JTSLineTable *)payload;
+
+  if ((0 == table->count) || (byte_index >= table->offsets[table->count])) {
+    *bytes_read = 0;
+    return "";
+  }
+
+  // reads are mostly sequential, so try the previous row and its
+  // successor before searching
+  int32_t row = table->last_row;
+  if (!((table->offsets[row] <= byte_index) &&
+        (byte_index < table->offsets[row + 1]))) {
+    row++;
+    if (!((row < table->count) &&
+          (table->offsets[row] <= byte_index) &&
+          (byte_index < table->offsets[row + 1]))) {
+      // find the last row starting at or before byte_index -- as
+      // byte_index is less than the total, that row is non-empty
+      int32_t lo = 0;
+      int32_t hi = table->count;
+      while (hi - lo > 1) {
+        int32_t mid = lo + (hi - lo) / 2;
+        if (table->offsets[mid] <= byte_index) {
+          lo = mid;
+        } else {
+          hi = mid;
+        }
+      }
+      row = lo;
+    }
+  }
+  table->last_row = row;
+
+  uint32_t col = byte_index - table->offsets[row];
+  *bytes_read = table->offsets[row + 1] - byte_index;
+
+  return (const char *)table->data[row] + col;
+}
+
+/**
+ * Use the parser to parse some source code and create a syntax tree.
+ *
+ * If you are parsing this document for the first time, pass `NULL` for the
+ * `old_tree` parameter. Otherwise, if you have already parsed an earlier
+ * version of this document and the document has since been edited, pass the
+ * previous syntax tree so that the unchanged parts of it can be reused.
+ * This will save time and memory. For this to work correctly, you must have
+ * already edited the old syntax tree using the `ts_tree_edit` function in a
+ * way that exactly matches the source code changes.
+ *
+ * The `TSInput` parameter lets you specify how to read the text. It has the
+ * following three fields:
+ * 1. `read`: A function to retrieve a chunk of text at a given byte offset
+ *    and (row, column) position. The function should return a pointer to the
+ *    text and write its length to the `bytes_read` pointer. The parser does
+ *    not take ownership of this buffer; it just borrows it until it has
+ *    finished reading it. The function should write a zero value to the
+ *    `bytes_read` pointer to indicate the end of the document.
+ * 2. `payload`: An arbitrary pointer that will be passed to each invocation
+ *    of the `read` function.
+ * 3. `encoding`: An indication of how the text is encoded. Either
+ *    `TSInputEncodingUTF8` or `TSInputEncodingUTF16`.
+ *
+ * This function returns a syntax tree on success, and `NULL` on failure. There
+ * are three possible reasons for failure:
+ * 1. The parser does not have a language assigned. Check for this using the
+      `ts_parser_language` function.
+ * 2. Parsing was cancelled due to a timeout that was set by an earlier call to
+ *    the `ts_parser_set_timeout_micros` function. You can resume parsing from
+ *    where the parser left out by calling `ts_parser_parse` again with the
+ *    same arguments. Or you can start parsing from scratch by first calling
+ *    `ts_parser_reset`.
+ * 3. Parsing was cancelled using a cancellation flag that was set by an
+ *    earlier call to `ts_parser_set_cancellation_flag`. You can resume parsing
+ *    from where the parser left out by calling `ts_parser_parse` again with
+ *    the same arguments.
+ */
+static Janet cfun_parser_parse(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 3);
+
+  JTSParser *parser_p = jts_get_parser(argv, 0);
+
+  TSTree *old_tree_p = NULL;
+
+  Janet x = argv[1];
+  if (janet_checktype(x, JANET_NIL)) {
+    old_tree_p = NULL;
+  } else if (janet_checktype(x, JANET_ABSTRACT)) {
+    JTSTree *temp_tree_p = jts_get_tree(argv, 1);
+    if (NULL == temp_tree_p) {
+      return janet_wrap_nil();
+    }
+
+    old_tree_p = temp_tree_p->tree;
+  } else {
+    return janet_wrap_nil();
+  }
+
+  JanetArray *lines = janet_getarray(argv, 2);
+
+  JTSLineTable table;
+  jts_line_table_init(&table, lines);
+
+  TSInput input = (TSInput) {
+    .payload = (void *)&table,
+    .read = &jts_read_lines_fn,
+    .encoding = TSInputEncodingUTF8
+  };
+
+  TSTree *new_tree_p = ts_parser_parse(parser_p->parser, old_tree_p, input);
+  jts_line_table_deinit(&table);
+  if (NULL == new_tree_p) {
+    return janet_wrap_nil();
+  }
+
+  return jts_wrap_tree(new_tree_p, janet_wrap_nil());
+}
+
+/**
+ * Use the parser to parse some source code stored in one contiguous buffer.
+ * The first two parameters are the same as in the `ts_parser_parse` function
+ * above. The second two parameters indicate the location of the buffer and its
+ * length in bytes.
+ */
+static Janet cfun_parser_parse_string(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 3);
+
+  JTSParser *parser_p = jts_get_parser(argv, 0);
+
+  TSTree *old_tree_p = NULL;
+
+  int32_t s_idx = 0;
+
+  if (argc == 2) {
+    s_idx = 1;
+  } else {
+    JTSTree *temp_tree_p = jts_get_tree(argv, 1);
+    if (NULL == temp_tree_p) {
+      return janet_wrap_nil();
+    }
+
+    old_tree_p = temp_tree_p->tree;
+
+    s_idx = 2;
+  }
+
+  // the known length is used so there is no rescan and embedded NULs
+  // are not a problem
+  JanetByteView src = janet_getbytes(argv, s_idx);
+
+  TSTree *new_tree_p =
+    ts_parser_parse_string(parser_p->parser, (const TSTree *)old_tree_p,
+                           (const char *)src.bytes, (uint32_t)src.len);
+  if (NULL == new_tree_p) {
+    return janet_wrap_nil();
+  }
+
+  return jts_wrap_tree(new_tree_p, janet_wrap_nil());
+}
+
+/**
+ * Parse a string, buffer, or a slice of either in place.
+ *
+ * Arguments are the parser, an old tree (or nil), the source, and
+ * optionally a byte offset and a byte length selecting a slice of the
+ * source.  The source is read directly from Janet's memory, so no copy
+ * is made.  Byte offsets in the resulting tree are relative to the start
+ * of the slice (see the optional offset argument of a node's `text`).
+ */
+static Janet cfun_parser_parse_bytes(int32_t argc, Janet *argv) {
+  janet_arity(argc, 3, 5);
+
+  JTSParser *parser_p = jts_get_parser(argv, 0);
+
+  TSTree *old_tree_p = NULL;
+  if (!janet_checktype(argv[1], JANET_NIL)) {
+    old_tree_p = jts_get_tree(argv, 1)->tree;
+  }
+
+  JanetByteView src = janet_getbytes(argv, 2);
+
+  int32_t start = janet_optnat(argv, argc, 3, 0);
+  if (start > src.len) {
+    janet_panicf("start %d is beyond end of source (length %d)",
+                 start, src.len);
+  }
+
+  int32_t len = janet_optnat(argv, argc, 4, src.len - start);
+  if (len > src.len - start) {
+    janet_panicf("length %d from start %d exceeds source (length %d)",
+                 len, start, src.len);
+  }
+
+  // no janet allocation happens while parsing, so the source's memory
+  // stays put for the duration of the call
+  TSTree *new_tree_p =
+    ts_parser_parse_string(parser_p->parser, (const TSTree *)old_tree_p,
+                           (const char *)src.bytes + start, (uint32_t)len);
+  if (NULL == new_tree_p) {
+    return janet_wrap_nil();
+  }
+
+  return jts_wrap_tree(new_tree_p, janet_wrap_nil());
+}
+
+/**
+ * Parse the file at `path`, reading it through a read-only memory
+ * mapping rather than into Janet's heap.
+ *
+ * Arguments are the parser, the path, and optionally an old tree.  The
+ * resulting tree keeps the mapping alive; get it with the tree's
+ * `:source` to pass to a node's `:text`.  Returns nil if the file cannot
+ * be mapped or parsing fails.
+ */
+static Janet cfun_parser_parse_file(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 3);
+
+  JTSParser *parser_p = jts_get_parser(argv, 0);
+
+  const char *path = (const char *)janet_getcstring(argv, 1);
+
+  TSTree *old_tree_p = NULL;
+  if ((argc > 2) && !janet_checktype(argv[2], JANET_NIL)) {
+    old_tree_p = jts_get_tree(argv, 2)->tree;
+  }
+
+  Janet mapping = jts_wrap_mapping(path);
+  if (janet_checktype(mapping, JANET_NIL)) {
+    return janet_wrap_nil();
+  }
+
+  JTSMapping *mapping_p = *(JTSMapping **)janet_unwrap_abstract(mapping);
+
+  // tree-sitter reads the pages straight from the mapping
+  TSTree *new_tree_p =
+    ts_parser_parse_string(parser_p->parser, (const TSTree *)old_tree_p,
+                           (const char *)mapping_p->data,
+                           (uint32_t)mapping_p->len);
+  if (NULL == new_tree_p) {
+    return janet_wrap_nil();
+  }
+
+  return jts_wrap_tree(new_tree_p, mapping);
+}
+
+void log_by_eprint(void *payload, TSLogType type, const char *message) {
+  (void)payload;
+  if (type == TSLogTypeLex) {
+    janet_eprintf("  %s\n", message);
+  } else {
+    janet_eprintf("%s\n", message);
+  }
+}
+
+static Janet cfun_parser_log_by_eprint(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSParser *parser_p = jts_get_parser(argv, 0);
+
+  TSLogger logger = {parser_p->parser, log_by_eprint};
+
+  ts_parser_set_logger(parser_p->parser, logger);
+
+  return janet_wrap_nil();
+}
+
+static Janet cfun_parser_print_dot_graphs_0(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSParser *parser_p = jts_get_parser(argv, 0);
+
+  // XXX: is this safe?
+  JanetFile *of =
+    (JanetFile *)janet_getabstract(argv, 1, &janet_file_type);
+  if (NULL == of) {
+    return janet_wrap_nil();
+  }
+
+  // XXX: check of->flags to make sure writable?
+  //      what about append, etc.?
+  if (!(of->flags & JANET_FILE_WRITE)) {
+    return janet_wrap_nil();
+  }
+
+  // XXX: britle?
+  // XXX: ended up including portions of parser.c near beginning
+  //      of this file to get this working...
+  parser_p->parser->dot_graph_file = of->file;
+
+  // XXX: more useful than nil as a return value?
+  return janet_wrap_true();
+}
+
+/**
+ * Set the maximum duration in microseconds that parsing should be allowed
+ * to take before halting.
+ *
+ * If parsing takes longer than this, it will halt early, returning nil.
+ * See `parse` for more information.
+ */
+static Janet cfun_parser_set_timeout_micros(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSParser *parser_p = jts_get_parser(argv, 0);
+
+  int64_t micros = janet_getinteger64(argv, 1);
+  if (micros < 0) {
+    janet_panicf("expected non-negative timeout, got %v", argv[1]);
+  }
+
+  ts_parser_set_timeout_micros(parser_p->parser, (uint64_t)micros);
+
+  return janet_wrap_nil();
+}
+
+/**
+ * Get the duration in microseconds that parsing is allowed to take.
+ */
+static Janet cfun_parser_timeout_micros(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSParser *parser_p = jts_get_parser(argv, 0);
+
+  return janet_wrap_number((double)ts_parser_timeout_micros(parser_p->parser));
+}
+
+/**
+ * Set the parser's current cancellation flag.
+ *
+ * If a non-nil flag is given, the parser will periodically check its
+ * state during parsing.  If it has been set (e.g. by `cancel`, possibly
+ * from another thread), the parser halts early, returning nil.  Pass nil
+ * to stop using a flag.
+ */
+static Janet cfun_parser_set_cancellation_flag(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSParser *parser_p = jts_get_parser(argv, 0);
+
+  if (janet_checktype(argv[1], JANET_NIL)) {
+    ts_parser_set_cancellation_flag(parser_p->parser, NULL);
+    parser_p->cancellation_flag = janet_wrap_nil();
+    return janet_wrap_nil();
+  }
+
+  JTSFlagState **state_pp =
+    (JTSFlagState **)janet_getabstract(argv, 1, &jts_cancellation_flag_type);
+
+  ts_parser_set_cancellation_flag(parser_p->parser, &(*state_pp)->flag);
+  parser_p->cancellation_flag = argv[1];
+
+  return janet_wrap_nil();
+}
+
+/**
+ * Get the parser's current cancellation flag, or nil.
+ */
+static Janet cfun_parser_cancellation_flag(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSParser *parser_p = jts_get_parser(argv, 0);
+
+  return parser_p->cancellation_flag;
+}
+
+/**
+ * Instruct the parser to start the next parse from the beginning.
+ *
+ * If the parser previously failed because of a timeout or a cancellation,
+ * then by default, it will resume where it left off on the next call to
+ * a parse method.  If you don't want to resume, and instead intend to use
+ * this parser to parse some other document, you must call `reset` first.
+ */
+static Janet cfun_parser_reset(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSParser *parser_p = jts_get_parser(argv, 0);
+
+  ts_parser_reset(parser_p->parser);
+
+  return janet_wrap_nil();
+}
+
+static const JanetMethod parser_methods[] = {
+  //{"new", cfun_parser_new},
+  //{"delete", cfun_parser_delete},
+  {"set-language", cfun_parser_set_language},
+  {"language", cfun_parser_language},
+  //{"set-included-ranges", cfun_parser_set_included_ranges},
+  //{"included-ranges", cfun_parser_included_ranges},
+  {"parse", cfun_parser_parse},
+  {"parse-string", cfun_parser_parse_string},
+  //{"parse-string-encoding", cfun_parser_parse_string_encoding},
+  {"reset", cfun_parser_reset},
+  {"set-timeout-micros", cfun_parser_set_timeout_micros},
+  {"timeout-micros", cfun_parser_timeout_micros},
+  {"set-cancellation-flag", cfun_parser_set_cancellation_flag},
+  {"cancellation-flag", cfun_parser_cancellation_flag},
+  //{"set-logger", cfun_parser_set_logger},
+  //{"logger", cfun_parser_logger},
+  //{"print-dot-graphs", cfun_parser_print_dot_graphs},
+  // custom
+  {"parse-bytes", cfun_parser_parse_bytes},
+  {"parse-file", cfun_parser_parse_file},
+  {"print-dot-graphs-0", cfun_parser_print_dot_graphs_0},
+  {"log-by-eprint", cfun_parser_log_by_eprint},
+  {NULL, NULL}
+};
+
+static int jts_parser_gc(void *p, size_t size) {
+  (void) size;
+
+  JTSParser *parser_p = (JTSParser *)p;
+  if (NULL != parser_p->pool) {
+    // checked out but never released
+    jts_parser_pool_return(parser_p->pool, parser_p->parser);
+    jts_parser_pool_unref(parser_p->pool);
+    parser_p->pool = NULL;
+  } else if (parser_p->parser != NULL) {
+    ts_parser_delete(parser_p->parser);
+  }
+  parser_p->parser = NULL;
+
+  return 0;
+}
+
+static int jts_parser_gcmark(void *p, size_t size) {
+  (void) size;
+
+  JTSParser *parser_p = (JTSParser *)p;
+  janet_mark(parser_p->cancellation_flag);
+
+  return 0;
+}
+
+static int jts_parser_get(void *p, Janet key, Janet *out) {
+  (void) p;
+
+  if (!janet_checktype(key, JANET_KEYWORD)) {
+    return 0;
+  }
+
+  return janet_getmethod(janet_unwrap_keyword(key), parser_methods, out);
+}
+
+////////
+
+static JTSFlagState **jts_get_cancellation_flag(const Janet *argv,
+                                                int32_t n) {
+  return (JTSFlagState **)janet_getabstract(argv, n,
+                                            &jts_cancellation_flag_type);
+}
+
+/**
+ * Create a new, unset cancellation flag.
+ *
+ * The flag can be sent to other janet threads (e.g. via `ev/thread`
+ * channels) and set there to cancel a parse in progress.
+ */
+static Janet cfun_cancellation_flag_new(int32_t argc, Janet *argv) {
+  (void)argv;
+  janet_fixarity(argc, 0);
+
+  JTSFlagState **state_pp =
+    (JTSFlagState **)janet_abstract(&jts_cancellation_flag_type,
+                                    sizeof(JTSFlagState *));
+
+  *state_pp = (JTSFlagState *)malloc(sizeof(JTSFlagState));
+  if (NULL == *state_pp) {
+    janet_panic("failed to allocate cancellation flag");
+  }
+  (*state_pp)->flag = 0;
+  (*state_pp)->refcount = 1;
+
+  return janet_wrap_abstract(state_pp);
+}
+
+static Janet cfun_cancellation_flag_cancel(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSFlagState **state_pp = jts_get_cancellation_flag(argv, 0);
+  jts_atomic_store_size(&(*state_pp)->flag, 1);
+
+  return janet_wrap_nil();
+}
+
+static Janet cfun_cancellation_flag_clear(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSFlagState **state_pp = jts_get_cancellation_flag(argv, 0);
+  jts_atomic_store_size(&(*state_pp)->flag, 0);
+
+  return janet_wrap_nil();
+}
+
+static Janet cfun_cancellation_flag_is_set(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSFlagState **state_pp = jts_get_cancellation_flag(argv, 0);
+
+  return janet_wrap_boolean(0 != jts_atomic_load_size(&(*state_pp)->flag));
+}
+
+static const JanetMethod cancellation_flag_methods[] = {
+  {"cancel", cfun_cancellation_flag_cancel},
+  {"clear", cfun_cancellation_flag_clear},
+  {"is-set", cfun_cancellation_flag_is_set},
+  {NULL, NULL}
+};
+
+static int jts_cancellation_flag_gc(void *p, size_t size) {
+  (void) size;
+
+  JTSFlagState **state_pp = (JTSFlagState **)p;
+  if (*state_pp != NULL) {
+    if (0 == jts_atomic_dec(&(*state_pp)->refcount)) {
+      free(*state_pp);
+    }
+    *state_pp = NULL;
+  }
+
+  return 0;
+}
+
+static int jts_cancellation_flag_get(void *p, Janet key, Janet *out) {
+  (void) p;
+
+  if (!janet_checktype(key, JANET_KEYWORD)) {
+    return 0;
+  }
+
+  return janet_getmethod(janet_unwrap_keyword(key),
+                         cancellation_flag_methods,
+                         out);
+}
+
+// marshaling shares the underlying state -- only meaningful within one
+// process, e.g. when sending the flag to another janet thread
+
+static void jts_cancellation_flag_marshal(void *p, JanetMarshalContext *ctx) {
+  JTSFlagState **state_pp = (JTSFlagState **)p;
+
+  jts_marshal_check_unsafe(ctx, "cancellation flag");
+  janet_marshal_abstract(ctx, p);
+  jts_atomic_inc(&(*state_pp)->refcount);
+  janet_marshal_ptr(ctx, *state_pp);
+}
+
+static void *jts_cancellation_flag_unmarshal(JanetMarshalContext *ctx) {
+  JTSFlagState **state_pp =
+    (JTSFlagState **)janet_unmarshal_abstract(ctx, sizeof(JTSFlagState *));
+
+  *state_pp = (JTSFlagState *)janet_unmarshal_ptr(ctx);
+
+  return state_pp;
+}
+
+////////
+
+static JTSParserPool *jts_get_parser_pool(const Janet *argv, int32_t n) {
+  return *(JTSParserPool **)janet_getabstract(argv, n,
+                                              &jts_parser_pool_type);
+}
+
+static TSParser *jts_parser_pool_new_parser(const TSLanguage *lang) {
+  TSParser *parser = ts_parser_new();
+  if (NULL == parser) {
+    return NULL;
+  }
+
+  if (!ts_parser_set_language(parser, lang)) {
+    ts_parser_delete(parser);
+    return NULL;
+  }
+
+  return parser;
+}
+
+/**
+ * Create a pool of parsers for `lang` keeping at most `capacity` idle
+ * parsers (default: the number of processors), `warm` (default 0) of
+ * which are created up front.
+ */
+static Janet cfun_parser_pool_new(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, 3);
+
+  TSLanguage **lang_pp = jts_get_language(argv, 0);
+  int32_t capacity = janet_optnat(argv, argc, 1, jts_cpu_count());
+  int32_t warm = janet_optnat(argv, argc, 2, 0);
+  if (warm > capacity) {
+    janet_panicf("cannot warm %d parsers in a pool of capacity %d",
+                 warm, capacity);
+  }
+
+  JTSParserPool **pool_pp =
+    (JTSParserPool **)janet_abstract(&jts_parser_pool_type,
+                                     sizeof(JTSParserPool *));
+  *pool_pp = NULL;
+
+  JTSParserPool *pool = (JTSParserPool *)calloc(1, sizeof(JTSParserPool));
+  if (NULL == pool) {
+    janet_panic("failed to allocate parser pool");
+  }
+
+  // at least one slot so a zero capacity pool still has an array
+  pool->idle = (TSParser **)malloc(sizeof(TSParser *) *
+                                   ((size_t)capacity + 1));
+  if (NULL == pool->idle) {
+    free(pool);
+    janet_panic("failed to allocate parser pool");
+  }
+
+  pool->language = *lang_pp;
+  pool->capacity = (uint32_t)capacity;
+  pool->refcount = 1;
+  jts_mutex_init(&pool->lock);
+  *pool_pp = pool;
+
+  for (int32_t i = 0; i < warm; i++) {
+    TSParser *parser = jts_parser_pool_new_parser(pool->language);
+    if (NULL == parser) {
+      janet_panic("failed to create parser");
+    }
+    pool->idle[pool->idle_count++] = parser;
+    pool->created++;
+  }
+
+  return janet_wrap_abstract(pool_pp);
+}
+
+/**
+ * Hand out an idle parser from the pool, or a new one if none is idle.
+ * Give it back with `release` when done.
+ */
+static Janet cfun_parser_pool_checkout(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSParserPool *pool = jts_get_parser_pool(argv, 0);
+
+  uint64_t start = jts_now_micros();
+
+  TSParser *parser = NULL;
+  jts_mutex_lock(&pool->lock);
+  if (pool->idle_count > 0) {
+    parser = pool->idle[--pool->idle_count];
+  }
+  jts_mutex_unlock(&pool->lock);
+
+  int created = 0;
+  if (NULL == parser) {
+    parser = jts_parser_pool_new_parser(pool->language);
+    if (NULL == parser) {
+      (void)fprintf(stderr, "failed to create parser\n");
+      return janet_wrap_nil();
+    }
+    created = 1;
+  }
+
+  uint64_t elapsed = jts_now_micros() - start;
+
+  jts_mutex_lock(&pool->lock);
+  pool->in_use++;
+  pool->checkouts++;
+  pool->created += (uint64_t)created;
+  pool->checkout_micros += elapsed;
+  if (elapsed > pool->max_checkout_micros) {
+    pool->max_checkout_micros = elapsed;
+  }
+  jts_mutex_unlock(&pool->lock);
+
+  JTSParser *parser_p =
+    (JTSParser *)janet_abstract(&jts_parser_type, sizeof(JTSParser));
+  parser_p->parser = parser;
+  parser_p->cancellation_flag = janet_wrap_nil();
+  jts_atomic_inc(&pool->refcount);
+  parser_p->pool = pool;
+
+  return janet_wrap_abstract(parser_p);
+}
+
+// reset `parser` and keep it for reuse if there is room, for a parser
+// checked out from `pool`
+static void jts_parser_pool_return(JTSParserPool *pool, TSParser *parser) {
+  TSLogger no_logger = {NULL, NULL};
+
+  // the flag and logger may already be gone, so drop them first
+  ts_parser_set_cancellation_flag(parser, NULL);
+  ts_parser_set_logger(parser, no_logger);
+  parser->dot_graph_file = NULL;
+  ts_parser_set_timeout_micros(parser, 0);
+  ts_parser_reset(parser);
+
+  int keep = (ts_parser_language(parser) == pool->language) ||
+    ts_parser_set_language(parser, pool->language);
+
+  jts_mutex_lock(&pool->lock);
+  pool->in_use--;
+  if (keep && (pool->idle_count < pool->capacity)) {
+    pool->idle[pool->idle_count++] = parser;
+    parser = NULL;
+  } else {
+    pool->discarded++;
+  }
+  jts_mutex_unlock(&pool->lock);
+
+  if (NULL != parser) {
+    ts_parser_delete(parser);
+  }
+}
+
+/**
+ * Give `parser` back to the pool it was checked out from.  It is reset
+ * (including its timeout, cancellation flag, and logger) and kept for
+ * reuse if the pool has room.  Either way, `parser` itself can no
+ * longer be used.  A checked out parser that is garbage collected
+ * without being released goes back to the pool the same way.
+ */
+static Janet cfun_parser_pool_release(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSParserPool *pool = jts_get_parser_pool(argv, 0);
+  JTSParser *parser_p = jts_get_parser(argv, 1);
+  if (parser_p->pool != pool) {
+    janet_panic("parser was not checked out from this pool");
+  }
+
+  TSParser *parser = parser_p->parser;
+  parser_p->parser = NULL;
+  parser_p->cancellation_flag = janet_wrap_nil();
+  parser_p->pool = NULL;
+
+  jts_parser_pool_return(pool, parser);
+  jts_parser_pool_unref(pool);
+
+  return janet_wrap_nil();
+}
+
+/**
+ * Get the language of the pool's parsers.
+ */
+static Janet cfun_parser_pool_language(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSParserPool *pool = jts_get_parser_pool(argv, 0);
+
+  return jts_wrap_language(pool->language);
+}
+
+/**
+ * Get a struct describing the pool's occupancy and checkouts:
+ * `:idle`, `:in-use`, `:capacity`, `:checkouts`, `:created`,
+ * `:discarded`, and the total and maximum checkout latency in
+ * microseconds as `:checkout-micros` and `:max-checkout-micros`.
+ */
+static Janet cfun_parser_pool_stats(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSParserPool *pool = jts_get_parser_pool(argv, 0);
+
+  jts_mutex_lock(&pool->lock);
+  double idle = (double)pool->idle_count;
+  double in_use = (double)pool->in_use;
+  double capacity = (double)pool->capacity;
+  double checkouts = (double)pool->checkouts;
+  double created = (double)pool->created;
+  double discarded = (double)pool->discarded;
+  double micros = (double)pool->checkout_micros;
+  double max_micros = (double)pool->max_checkout_micros;
+  jts_mutex_unlock(&pool->lock);
+
+  JanetKV *st = janet_struct_begin(8);
+  janet_struct_put(st, janet_ckeywordv("idle"), janet_wrap_number(idle));
+  janet_struct_put(st, janet_ckeywordv("in-use"), janet_wrap_number(in_use));
+  janet_struct_put(st, janet_ckeywordv("capacity"),
+                   janet_wrap_number(capacity));
+  janet_struct_put(st, janet_ckeywordv("checkouts"),
+                   janet_wrap_number(checkouts));
+  janet_struct_put(st, janet_ckeywordv("created"),
+                   janet_wrap_number(created));
+  janet_struct_put(st, janet_ckeywordv("discarded"),
+                   janet_wrap_number(discarded));
+  janet_struct_put(st, janet_ckeywordv("checkout-micros"),
+                   janet_wrap_number(micros));
+  janet_struct_put(st, janet_ckeywordv("max-checkout-micros"),
+                   janet_wrap_number(max_micros));
+
+  return janet_wrap_struct(janet_struct_end(st));
+}
+
+static const JanetMethod parser_pool_methods[] = {
+  {"checkout", cfun_parser_pool_checkout},
+  {"release", cfun_parser_pool_release},
+  {"language", cfun_parser_pool_language},
+  {"stats", cfun_parser_pool_stats},
+  {NULL, NULL}
+};
+
+static void jts_parser_pool_unref(JTSParserPool *pool) {
+  if (0 == jts_atomic_dec(&pool->refcount)) {
+    for (uint32_t i = 0; i < pool->idle_count; i++) {
+      ts_parser_delete(pool->idle[i]);
+    }
+    free(pool->idle);
+    jts_mutex_destroy(&pool->lock);
+    free(pool);
+  }
+}
+
+static int jts_parser_pool_gc(void *p, size_t size) {
+  (void) size;
+
+  JTSParserPool **pool_pp = (JTSParserPool **)p;
+  if (*pool_pp != NULL) {
+    jts_parser_pool_unref(*pool_pp);
+    *pool_pp = NULL;
+  }
+
+  return 0;
+}
+
+static int jts_parser_pool_get(void *p, Janet key, Janet *out) {
+  (void) p;
+
+  if (!janet_checktype(key, JANET_KEYWORD)) {
+    return 0;
+  }
+
+  return janet_getmethod(janet_unwrap_keyword(key), parser_pool_methods,
+                         out);
+}
+
+// marshaling shares the pool -- only meaningful within one process
+
+static void jts_parser_pool_marshal(void *p, JanetMarshalContext *ctx) {
+  JTSParserPool **pool_pp = (JTSParserPool **)p;
+
+  jts_marshal_check_unsafe(ctx, "parser pool");
+  janet_marshal_abstract(ctx, p);
+  jts_atomic_inc(&(*pool_pp)->refcount);
+  janet_marshal_ptr(ctx, *pool_pp);
+}
+
+static void *jts_parser_pool_unmarshal(JanetMarshalContext *ctx) {
+  JTSParserPool **pool_pp =
+    (JTSParserPool **)janet_unmarshal_abstract(ctx, sizeof(JTSParserPool *));
+
+  *pool_pp = (JTSParserPool *)janet_unmarshal_ptr(ctx);
+
+  return pool_pp;
+}
+
+////////
+
+// a document owns its text as a piece table.  the original text is
+// copied once; inserted text is appended to blocks that never move, so
+// pieces can point straight into either.  pieces live in a treap ordered
+// by position where each node also summarizes its subtree's bytes and
+// newlines, so finding the piece holding a byte and converting a byte
+// offset to a point are logarithmic in the number of pieces.  text typed
+// right after the previous insertion extends that insertion's piece
+// instead of adding a new one.  newline positions of the original text
+// are indexed so splitting a piece of it does not rescan it.
+
+#define JTS_DOC_BLOCK_SIZE 65536
+
+typedef struct JTSDocBlock {
+  struct JTSDocBlock *next;
+  uint32_t size;
+  uint32_t used;
+  uint8_t data[];
+} JTSDocBlock;
+
+typedef struct {
+  const uint8_t *data;
+  uint32_t len;
+  uint32_t newlines;
+  // bytes following the last newline, only meaningful if newlines > 0
+  uint32_t tail;
+} JTSPiece;
+
+typedef struct JTSPieceNode {
+  struct JTSPieceNode *left;
+  struct JTSPieceNode *right;
+  JTSPiece piece;
+  // the whole subtree, in order (data is not meaningful)
+  JTSPiece sum;
+  uint32_t priority;
+} JTSPieceNode;
+
+typedef struct {
+  Janet parser;
+  TSTree *tree;
+  int dirty;
+  uint8_t *original;
+  uint32_t original_len;
+  uint32_t *original_nls;
+  uint32_t original_nl_count;
+  JTSDocBlock *blocks;
+  JTSPieceNode *root;
+  uint32_t length;
+  uint32_t seed;
+  // most recently read piece, for the TSInput callback
+  JTSPieceNode *read_node;
+  uint32_t read_start;
+} JTSDocument;
+
+// index of the first original newline at or after `pos`
+static uint32_t jts_doc_nl_lower_bound(JTSDocument *doc, uint32_t pos) {
+  uint32_t lo = 0;
+  uint32_t hi = doc->original_nl_count;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (doc->original_nls[mid] < pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
 
-  TSPoint start_point = (TSPoint) {
-    start_row, start_col
-  };
+static bool jts_doc_is_original(JTSDocument *doc, const uint8_t *data) {
+  return (NULL != doc->original) &&
+         (data >= doc->original) &&
+         (data < doc->original + doc->original_len);
+}
 
-  TSPoint end_point = (TSPoint) {
-    end_row, end_col
+static JTSPiece jts_doc_piece(JTSDocument *doc,
+                              const uint8_t *data, uint32_t len) {
+  JTSPiece piece = (JTSPiece) {
+    .data = data,
+    .len = len,
+    .newlines = 0,
+    .tail = 0
   };
 
-  TSNode *desc_p =
-    (TSNode *)janet_abstract(&jts_node_type, sizeof(TSNode));
-
-  *desc_p = ts_node_descendant_for_point_range(node, start_point, end_point);
-  if (ts_node_is_null(*desc_p)) {
-    return janet_wrap_nil();
+  if (jts_doc_is_original(doc, data)) {
+    uint32_t start = (uint32_t)(data - doc->original);
+    uint32_t lo = jts_doc_nl_lower_bound(doc, start);
+    uint32_t hi = jts_doc_nl_lower_bound(doc, start + len);
+    piece.newlines = hi - lo;
+    if (piece.newlines > 0) {
+      piece.tail = start + len - (doc->original_nls[hi - 1] + 1);
+    }
+  } else {
+    for (uint32_t i = 0; i < len; i++) {
+      if ('\n' == data[i]) {
+        piece.newlines++;
+        piece.tail = len - (i + 1);
+      }
+    }
   }
 
-  return janet_wrap_abstract(desc_p);
+  return piece;
 }
 
-/**
- * Check if two nodes are identical.
- */
-static Janet cfun_node_eq(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 2);
+// `a` followed by `b`
+static JTSPiece jts_doc_concat(JTSPiece a, JTSPiece b) {
+  return (JTSPiece) {
+    .data = a.data,
+    .len = a.len + b.len,
+    .newlines = a.newlines + b.newlines,
+    .tail = (b.newlines > 0) ? b.tail : a.tail + b.len
+  };
+}
 
-  TSNode node_l = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node_l)) {
-    return janet_wrap_nil();
+// the first `len` bytes of `piece`.  inserted pieces grow as text is
+// typed, so only the shorter side of the split is scanned, plus the
+// rest of the line before the split when scanning the suffix.
+static JTSPiece jts_doc_prefix(JTSDocument *doc,
+                               JTSPiece piece, uint32_t len) {
+  if (len == piece.len) {
+    return piece;
   }
 
-  TSNode node_r = *jts_get_node(argv, 1);
-  if (ts_node_is_null(node_r)) {
-    return janet_wrap_nil();
+  if (jts_doc_is_original(doc, piece.data) || (len <= piece.len - len)) {
+    return jts_doc_piece(doc, piece.data, len);
   }
 
-  if (ts_node_eq(node_l, node_r)) {
-    return janet_wrap_true();
+  uint32_t suffix_newlines = 0;
+  for (uint32_t i = len; i < piece.len; i++) {
+    if ('\n' == piece.data[i]) {
+      suffix_newlines++;
+    }
   }
 
-  return janet_wrap_false();
-}
-
-static Janet cfun_node_tree(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 1);
+  JTSPiece prefix = (JTSPiece) {
+    .data = piece.data,
+    .len = len,
+    .newlines = piece.newlines - suffix_newlines,
+    .tail = 0
+  };
 
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
-    return janet_wrap_nil();
+  if (prefix.newlines > 0) {
+    uint32_t i = len;
+    while ('\n' != piece.data[i - 1]) {
+      i--;
+    }
+    prefix.tail = len - i;
   }
 
-  TSTree **tree_pp =
-    (TSTree **)janet_abstract(&jts_tree_type, sizeof(TSTree *));
-
-  // XXX: casting to avoid warning, but don't really want to
-  //      allow *tree_pp to be modified after this point?
-  *tree_pp = (TSTree *)node.tree;
-
-  return janet_wrap_abstract(*tree_pp);
+  return prefix;
 }
 
-static Janet cfun_node_text(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 2);
+// what is left of `piece` after `prefix`
+static JTSPiece jts_doc_suffix(JTSPiece piece, JTSPiece prefix) {
+  return (JTSPiece) {
+    .data = piece.data + prefix.len,
+    .len = piece.len - prefix.len,
+    .newlines = piece.newlines - prefix.newlines,
+    .tail = piece.tail
+  };
+}
 
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
-    return janet_wrap_nil();
+static void jts_doc_advance_point(TSPoint *point, JTSPiece piece) {
+  if (piece.newlines > 0) {
+    point->row += piece.newlines;
+    point->column = piece.tail;
+  } else {
+    point->column += piece.len;
   }
+}
 
-  const char *source = (const char *)janet_getstring(argv, 1);
-  if (NULL == source) {
-    return janet_wrap_nil();
+static void jts_doc_update(JTSPieceNode *node) {
+  node->sum = node->piece;
+  if (NULL != node->left) {
+    node->sum = jts_doc_concat(node->left->sum, node->sum);
   }
+  if (NULL != node->right) {
+    node->sum = jts_doc_concat(node->sum, node->right->sum);
+  }
+}
 
-  uint32_t start = ts_node_start_byte(node);
-  uint32_t end = ts_node_end_byte(node);
+static uint32_t jts_doc_random(JTSDocument *doc) {
+  // xorshift32
+  uint32_t x = doc->seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  doc->seed = x;
+  return x;
+}
+
+static void jts_doc_free_nodes(JTSPieceNode *node) {
+  while (NULL != node) {
+    jts_doc_free_nodes(node->left);
+    JTSPieceNode *right = node->right;
+    free(node);
+    node = right;
+  }
+}
 
-  // XXX: could this be a problem if difference is large?
-  int32_t len = (int32_t)(end - start);
+// split `node` into the pieces before `byte` and those from `byte` on.
+// if `byte` falls inside a piece, `*spare` becomes its second half and
+// is set to NULL.
+static void jts_doc_split(JTSDocument *doc, JTSPieceNode *node,
+                          uint32_t byte,
+                          JTSPieceNode **left, JTSPieceNode **right,
+                          JTSPieceNode **spare) {
+  if (NULL == node) {
+    *left = NULL;
+    *right = NULL;
+    return;
+  }
 
-  return janet_stringv((const uint8_t *)source + start, len);
+  uint32_t left_len = (NULL != node->left) ? node->left->sum.len : 0;
+
+  if (byte <= left_len) {
+    jts_doc_split(doc, node->left, byte, left, &node->left, spare);
+    jts_doc_update(node);
+    *right = node;
+  } else if (byte >= left_len + node->piece.len) {
+    jts_doc_split(doc, node->right, byte - left_len - node->piece.len,
+                  &node->right, right, spare);
+    jts_doc_update(node);
+    *left = node;
+  } else {
+    JTSPieceNode *second = *spare;
+    *spare = NULL;
+
+    JTSPiece prefix = jts_doc_prefix(doc, node->piece, byte - left_len);
+    second->piece = jts_doc_suffix(node->piece, prefix);
+    // same priority keeps `second` above node's old right subtree
+    second->priority = node->priority;
+    second->left = NULL;
+    second->right = node->right;
+    jts_doc_update(second);
+
+    node->piece = prefix;
+    node->right = NULL;
+    jts_doc_update(node);
+
+    *left = node;
+    *right = second;
+  }
 }
 
-static const JanetMethod node_methods[] = {
-  {"type", cfun_node_type},
-  //{"symbol", cfun_node_symbol},
-  {"start-byte", cfun_node_start_byte},
-  {"start-point", cfun_node_start_point},
-  {"end-byte", cfun_node_end_byte},
-  {"end-point", cfun_node_end_point},
-  {"string", cfun_node_string},
-  {"is-null", cfun_node_is_null},
-  {"is-named", cfun_node_is_named},
-  //{"is-missing", cfun_node_is_missing},
-  //{"is-extra", cfun_node_is_extra},
-  //{"has-changes", cfun_node_has_changes},
-  {"has-error", cfun_node_has_error},
-  {"parent", cfun_node_parent},
-  {"child", cfun_node_child},
-  //{"field-name-for-child", cfun_node_field_name_for_child},
-  {"child-count", cfun_node_child_count},
-  {"named-child", cfun_node_named_child},
-  {"named-child-count", cfun_node_named_child_count},
-  //{"child-by-field-name", cfun_node_child_by_field-name},
-  //{"child-by-field-id", cfun_node_child_by_field-id},
-  {"next-sibling", cfun_node_next_sibling},
-  {"prev-sibling", cfun_node_prev_sibling},
-  //{"next-named-sibling", cfun_node_next_named_sibling},
-  //{"prev-named-sibling", cfun_node_prev_named_sibling},
-  {"first-child-for-byte", cfun_node_first_child_for_byte},
-  {"first-named-child-for-byte", cfun_node_first_named_child_for_byte},
-  {"descendant-for-byte-range", cfun_node_descendant_for_byte_range},
-  {"descendant-for-point-range", cfun_node_descendant_for_point_range},
-  /*
-  {"named-descendant-for-byte-range",
-   cfun_node_named_descendant_for_byte_range},
-  {"named-descendant-for-point-range",
-   cfun_node_named_descendant_for_point_range},
-  */
-  //{"edit", cfun_node_edit}
-  {"eq", cfun_node_eq},
-  // custom
-  {"expr", cfun_node_string}, // alias for backward compatibility
-  {"tree", cfun_node_tree},
-  {"text", cfun_node_text},
-  {NULL, NULL}
-};
+static JTSPieceNode *jts_doc_merge(JTSPieceNode *left, JTSPieceNode *right) {
+  if (NULL == left) {
+    return right;
+  }
 
-int jts_node_get(void *p, Janet key, Janet *out) {
-  (void) p;
+  if (NULL == right) {
+    return left;
+  }
 
-  if (!janet_checktype(key, JANET_KEYWORD)) {
-    return 0;
+  if (left->priority >= right->priority) {
+    left->right = jts_doc_merge(left->right, right);
+    jts_doc_update(left);
+    return left;
   }
 
-  return janet_getmethod(janet_unwrap_keyword(key), node_methods, out);
+  right->left = jts_doc_merge(left, right->left);
+  jts_doc_update(right);
+  return right;
 }
 
-////////
+static JTSPieceNode *jts_doc_last(JTSPieceNode *node) {
+  while ((NULL != node) && (NULL != node->right)) {
+    node = node->right;
+  }
+  return node;
+}
 
-static TSTree **jts_get_tree(const Janet *argv, int32_t n) {
-  return (TSTree **)janet_getabstract(argv, n, &jts_tree_type);
+// append `piece` to the last piece under `node`
+static void jts_doc_extend_last(JTSPieceNode *node, JTSPiece piece) {
+  if (NULL != node->right) {
+    jts_doc_extend_last(node->right, piece);
+  } else {
+    node->piece = jts_doc_concat(node->piece, piece);
+  }
+  jts_doc_update(node);
 }
 
-/**
- * Get the root node of the syntax tree.
- */
-static Janet cfun_tree_root_node(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 1);
+static TSPoint jts_doc_point_for_byte(JTSDocument *doc, uint32_t byte) {
+  TSPoint point = (TSPoint) {
+    0, 0
+  };
 
-  TSTree **tree_pp = jts_get_tree(argv, 0);
-  // XXX: error checking?
+  JTSPieceNode *node = doc->root;
+  while (NULL != node) {
+    if (NULL != node->left) {
+      if (byte < node->left->sum.len) {
+        node = node->left;
+        continue;
+      }
+      jts_doc_advance_point(&point, node->left->sum);
+      byte -= node->left->sum.len;
+    }
 
-  TSNode *node_p =
-    (TSNode *)janet_abstract(&jts_node_type, sizeof(TSNode));
+    if (byte < node->piece.len) {
+      jts_doc_advance_point(&point, jts_doc_prefix(doc, node->piece, byte));
+      break;
+    }
 
-  *node_p = ts_tree_root_node(*tree_pp);
-  if (ts_node_is_null(*node_p)) {
-    return janet_wrap_nil();
+    jts_doc_advance_point(&point, node->piece);
+    byte -= node->piece.len;
+    node = node->right;
   }
 
-  return janet_wrap_abstract(node_p);
+  return point;
 }
 
-/**
- * Edit the syntax tree to keep it in sync with source code that has been
- * edited.
- *
- * You must describe the edit both in terms of byte offsets and in terms of
- * (row, column) coordinates.
- */
-static Janet cfun_tree_edit(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 10);
+// find the piece containing `byte` and where it starts, NULL at the end
+static JTSPieceNode *jts_doc_locate(JTSDocument *doc, uint32_t byte,
+                                    uint32_t *start) {
+  uint32_t base = 0;
+  JTSPieceNode *node = doc->root;
+  while (NULL != node) {
+    uint32_t left_len = (NULL != node->left) ? node->left->sum.len : 0;
+    if (byte < base + left_len) {
+      node = node->left;
+    } else if (byte < base + left_len + node->piece.len) {
+      *start = base + left_len;
+      return node;
+    } else {
+      base += left_len + node->piece.len;
+      node = node->right;
+    }
+  }
 
-  TSTree **tree_pp = jts_get_tree(argv, 0);
-  // XXX: error checking?
+  *start = base;
+  return NULL;
+}
 
-  uint32_t start_byte = janet_getinteger(argv, 1);
-  uint32_t old_end_byte = janet_getinteger(argv, 2);
-  uint32_t new_end_byte = janet_getinteger(argv, 3);
-  TSPoint start_point = (TSPoint) {
-    (uint32_t)janet_getinteger(argv, 4),
-    (uint32_t)janet_getinteger(argv, 5)
-  };
-  TSPoint old_end_point = (TSPoint) {
-    (uint32_t)janet_getinteger(argv, 6),
-    (uint32_t)janet_getinteger(argv, 7)
-  };
-  TSPoint new_end_point = (TSPoint) {
-    (uint32_t)janet_getinteger(argv, 8),
-    (uint32_t)janet_getinteger(argv, 9)
-  };
+// make room for `len` more bytes in the current block
+static bool jts_doc_reserve(JTSDocument *doc, uint32_t len) {
+  JTSDocBlock *block = doc->blocks;
+  if ((NULL != block) && (block->size - block->used >= len)) {
+    return true;
+  }
 
-  TSInputEdit input_edit = (TSInputEdit) {
-    .start_byte = start_byte,
-    .old_end_byte = old_end_byte,
-    .new_end_byte = new_end_byte,
-    .start_point = start_point,
-    .old_end_point = old_end_point,
-    .new_end_point = new_end_point
-  };
+  uint32_t size = (len > JTS_DOC_BLOCK_SIZE) ? len : JTS_DOC_BLOCK_SIZE;
+  block = (JTSDocBlock *)malloc(sizeof(JTSDocBlock) + size);
+  if (NULL == block) {
+    return false;
+  }
 
-  ts_tree_edit(*tree_pp, &input_edit);
+  block->size = size;
+  block->used = 0;
+  block->next = doc->blocks;
+  doc->blocks = block;
 
-  return janet_wrap_nil();
+  return true;
 }
 
-/**
- * Compare an old edited syntax tree to a new syntax tree representing the same
- * document, returning an array of ranges whose syntactic structure has changed.
- *
- * For this to work correctly, the old syntax tree must have been edited such
- * that its ranges match up to the new tree. Generally, you'll want to call
- * this function right after calling one of the `ts_parser_parse` functions.
- * You need to pass the old tree that was passed to parse, as well as the new
- * tree that was returned from that function.
- *
- * The returned array is allocated using `malloc` and the caller is responsible
- * for freeing it using `free`. The length of the array will be written to the
- * given `length` pointer.
- */
-static Janet cfun_tree_get_changed_ranges(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 2);
+static void jts_doc_splice(JTSDocument *doc,
+                           uint32_t start, uint32_t old_end,
+                           const uint8_t *text, uint32_t len) {
+  // allocate up front so that failing leaves the document untouched:
+  // each of the two splits may need a node, as may the inserted text
+  JTSPieceNode *spares[3] = {NULL, NULL, NULL};
+  bool ok = true;
+  for (int i = 0; i < 3; i++) {
+    spares[i] = (JTSPieceNode *)malloc(sizeof(JTSPieceNode));
+    ok = ok && (NULL != spares[i]);
+  }
 
-  TSTree **old_tree_pp = jts_get_tree(argv, 0);
-  TSTree **new_tree_pp = jts_get_tree(argv, 1);
-  // XXX: error checking?
+  if (ok && (len > 0)) {
+    ok = jts_doc_reserve(doc, len);
+  }
 
-  uint32_t length = 0;
+  if (!ok) {
+    for (int i = 0; i < 3; i++) {
+      free(spares[i]);
+    }
+    janet_panic("failed to allocate document piece");
+  }
 
-  TSRange *range =
-    ts_tree_get_changed_ranges(*old_tree_pp, *new_tree_pp, &length);
+  JTSPieceNode *left, *middle, *right;
+  jts_doc_split(doc, doc->root, start, &left, &right, &spares[0]);
+  jts_doc_split(doc, right, old_end - start, &middle, &right, &spares[1]);
+  jts_doc_free_nodes(middle);
+
+  if (len > 0) {
+    JTSDocBlock *block = doc->blocks;
+    uint8_t *dest = block->data + block->used;
+    memcpy(dest, text, len);
+    block->used += len;
+
+    JTSPiece piece = jts_doc_piece(doc, dest, len);
+    JTSPieceNode *last = jts_doc_last(left);
+    if ((NULL != last) && (last->piece.data + last->piece.len == dest)) {
+      jts_doc_extend_last(left, piece);
+    } else {
+      JTSPieceNode *node = spares[2];
+      spares[2] = NULL;
+      node->left = NULL;
+      node->right = NULL;
+      node->piece = piece;
+      node->priority = jts_doc_random(doc);
+      jts_doc_update(node);
+      left = jts_doc_merge(left, node);
+    }
+  }
 
-  if (length == 0) {
-    free(range);
-    return janet_wrap_nil();
+  doc->root = jts_doc_merge(left, right);
+
+  for (int i = 0; i < 3; i++) {
+    free(spares[i]);
   }
 
-  Janet *ranges = janet_tuple_begin((int32_t)length);
+  doc->length = doc->length - (old_end - start) + len;
+  doc->read_node = NULL;
+  doc->read_start = 0;
+}
 
-  for (int i = 0; i < length; i++) {
-    Janet *tup = janet_tuple_begin(6);
-    tup[0] = janet_wrap_integer(range[i].start_byte);
-    tup[1] = janet_wrap_integer(range[i].end_byte);
-    tup[2] = janet_wrap_integer(range[i].start_point.row);
-    tup[3] = janet_wrap_integer(range[i].start_point.column);
-    tup[4] = janet_wrap_integer(range[i].end_point.row);
-    tup[5] = janet_wrap_integer(range[i].end_point.column);
-    ranges[i] = janet_wrap_tuple(janet_tuple_end(tup));
+static const char *jts_read_document_fn(void *payload,
+                                        uint32_t byte_index,
+                                        TSPoint position,
+                                        uint32_t *bytes_read) {
+  (void)position;
+  JTSDocument *doc = (JTSDocument *)payload;
+
+  if (byte_index >= doc->length) {
+    *bytes_read = 0;
+    return "";
   }
 
-  free(range);
+  // tree-sitter often rereads the piece it just read
+  JTSPieceNode *node = doc->read_node;
+  uint32_t start = doc->read_start;
+  if ((NULL == node) ||
+      (byte_index < start) ||
+      (byte_index >= start + node->piece.len)) {
+    node = jts_doc_locate(doc, byte_index, &start);
+  }
 
-  return janet_wrap_tuple(janet_tuple_end(ranges));
+  doc->read_node = node;
+  doc->read_start = start;
+
+  uint32_t offset = byte_index - start;
+  *bytes_read = node->piece.len - offset;
+
+  return (const char *)node->piece.data + offset;
+}
+
+static JTSDocument *jts_get_document(const Janet *argv, int32_t n) {
+  return (JTSDocument *)janet_getabstract(argv, n, &jts_document_type);
 }
 
 /**
- * Write a DOT graph describing the syntax tree to the given file.
+ * Create a new document holding a copy of `src`, parsed with `parser`.
+ *
+ * Parsing happens lazily, the first time the document's tree is asked
+ * for.
  */
-static Janet cfun_tree_print_dot_graph(int32_t argc, Janet *argv) {
+static Janet cfun_document_new(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 2);
 
-  TSTree **tree_pp = jts_get_tree(argv, 0);
-  // XXX: error checking?
+  (void)jts_get_parser(argv, 0);
+  JanetByteView src = janet_getbytes(argv, 1);
 
-  // XXX: is this safe?
-  JanetFile *of =
-    (JanetFile *)janet_getabstract(argv, 1, &janet_file_type);
+  JTSDocument *doc =
+    (JTSDocument *)janet_abstract(&jts_document_type, sizeof(JTSDocument));
+  memset(doc, 0, sizeof(JTSDocument));
+  doc->parser = argv[0];
+  doc->dirty = 1;
 
-  // XXX: check of->flags to make sure writable?
-  //      what about append, etc.?
-  if (!(of->flags & JANET_FILE_WRITE)) {
-    return janet_wrap_nil();
+  uint32_t len = (uint32_t)src.len;
+  uint32_t nl_count = 0;
+  for (uint32_t i = 0; i < len; i++) {
+    if ('\n' == src.bytes[i]) {
+      nl_count++;
+    }
   }
 
-  ts_tree_print_dot_graph(*tree_pp, of->file);
-
-  return janet_wrap_nil();
-}
+  // at least one byte each so a failed allocation is unambiguous
+  doc->original = (uint8_t *)malloc(len + 1);
+  doc->original_nls = (uint32_t *)malloc(sizeof(uint32_t) * (nl_count + 1));
+  if ((NULL == doc->original) || (NULL == doc->original_nls)) {
+    janet_panic("failed to allocate document");
+  }
+  doc->seed = 2463534242u;
 
-static const JanetMethod tree_methods[] = {
-  //{"copy", cfun_tree_copy},
-  //{"delete", cfun_tree_delete},
-  {"root-node", cfun_tree_root_node},
-  //{"root-node-with-offset", cfun_tree_root_node_with_offset},
-  //{"language", cfun_tree_language},
-  //{"included-ranges", cfun_tree_included_ranges},
-  {"edit", cfun_tree_edit},
-  {"get-changed-ranges", cfun_tree_get_changed_ranges},
-  {"print-dot-graph", cfun_tree_print_dot_graph},
-  {NULL, NULL}
-};
+  memcpy(doc->original, src.bytes, len);
+  doc->original_len = len;
 
-static int jts_tree_gc(void *p, size_t size) {
-  (void) size;
+  for (uint32_t i = 0; i < len; i++) {
+    if ('\n' == src.bytes[i]) {
+      doc->original_nls[doc->original_nl_count++] = i;
+    }
+  }
 
-  TSTree **tree_pp = (TSTree **)p;
-  if (*tree_pp != NULL) {
-    ts_tree_delete(*tree_pp);
-    *tree_pp = NULL;
+  if (len > 0) {
+    JTSPieceNode *node = (JTSPieceNode *)malloc(sizeof(JTSPieceNode));
+    if (NULL == node) {
+      janet_panic("failed to allocate document");
+    }
+    node->left = NULL;
+    node->right = NULL;
+    node->piece = jts_doc_piece(doc, doc->original, len);
+    node->priority = jts_doc_random(doc);
+    jts_doc_update(node);
+    doc->root = node;
   }
+  doc->length = len;
 
-  return 0;
+  return janet_wrap_abstract(doc);
 }
 
-static int jts_tree_get(void *p, Janet key, Janet *out) {
-  (void) p;
+/**
+ * Replace the bytes from `start-byte` up to `old-end-byte` with
+ * `new-text`.
+ *
+ * The row / column coordinates of the edit are computed from the
+ * document's own text, the current tree (if any) is edited to match,
+ * and the next request for the tree reparses incrementally.
+ */
+static Janet cfun_document_apply_edit(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 4);
 
-  if (!janet_checktype(key, JANET_KEYWORD)) {
-    return 0;
+  JTSDocument *doc = jts_get_document(argv, 0);
+  uint32_t start = (uint32_t)janet_getnat(argv, 1);
+  uint32_t old_end = (uint32_t)janet_getnat(argv, 2);
+  JanetByteView text = janet_getbytes(argv, 3);
+
+  if ((start > old_end) || (old_end > doc->length)) {
+    janet_panicf("invalid edit range [%d, %d) for document of length %d",
+                 (int32_t)start, (int32_t)old_end, (int32_t)doc->length);
   }
 
-  return janet_getmethod(janet_unwrap_keyword(key), tree_methods, out);
-}
+  uint32_t len = (uint32_t)text.len;
+
+  // points come from the text before the edit
+  TSPoint start_point = jts_doc_point_for_byte(doc, start);
+  TSPoint old_end_point = jts_doc_point_for_byte(doc, old_end);
+
+  TSPoint new_end_point = start_point;
+  for (uint32_t i = 0; i < len; i++) {
+    if ('\n' == text.bytes[i]) {
+      new_end_point.row++;
+      new_end_point.column = 0;
+    } else {
+      new_end_point.column++;
+    }
+  }
 
-////////
+  // splicing may panic, so do it before touching the tree
+  jts_doc_splice(doc, start, old_end, text.bytes, len);
+  doc->dirty = 1;
+
+  if (NULL != doc->tree) {
+    TSInputEdit input_edit = (TSInputEdit) {
+      .start_byte = start,
+      .old_end_byte = old_end,
+      .new_end_byte = start + len,
+      .start_point = start_point,
+      .old_end_point = old_end_point,
+      .new_end_point = new_end_point
+    };
+
+    ts_tree_edit(doc->tree, &input_edit);
+  }
 
-static TSParser **jts_get_parser(const Janet *argv, int32_t n) {
-  return (TSParser **)janet_getabstract(argv, n, &jts_parser_type);
+  return janet_wrap_nil();
 }
 
 /**
- * Get the parser's current language.
+ * Get the document's syntax tree, reparsing first if there have been
+ * edits since the last parse.
+ *
+ * The returned tree is an independent (cheap) copy, so it remains valid
+ * after further edits.
  */
-static Janet cfun_parser_language(int32_t argc, Janet *argv) {
+static Janet cfun_document_tree(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
 
-  TSParser **parser_pp = jts_get_parser(argv, 0);
+  JTSDocument *doc = jts_get_document(argv, 0);
 
-  TSLanguage **lang_pp =
-    (TSLanguage **)janet_abstract(&jts_language_type, sizeof(TSLanguage *));
+  if (doc->dirty || (NULL == doc->tree)) {
+    JTSParser *parser_p = (JTSParser *)janet_unwrap_abstract(doc->parser);
+    if (NULL == parser_p->parser) {
+      janet_panic("document's parser is unusable");
+    }
 
-  // XXX: casting to avoid warning, but don't really want to
-  //      allow *lang_pp to be modified after this point?
-  *lang_pp = (TSLanguage *)ts_parser_language(*parser_pp);
-  if (NULL == *lang_pp) {
-    return janet_wrap_nil();
+    TSInput input = (TSInput) {
+      .payload = (void *)doc,
+      .read = &jts_read_document_fn,
+      .encoding = TSInputEncodingUTF8
+    };
+
+    doc->read_node = NULL;
+    doc->read_start = 0;
+
+    TSTree *new_tree_p = ts_parser_parse(parser_p->parser, doc->tree, input);
+    if (NULL == new_tree_p) {
+      return janet_wrap_nil();
+    }
+
+    if (NULL != doc->tree) {
+      ts_tree_delete(doc->tree);
+    }
+    doc->tree = new_tree_p;
+    doc->dirty = 0;
   }
 
-  return janet_wrap_abstract(lang_pp);
+  return jts_wrap_tree(ts_tree_copy(doc->tree), janet_wrap_nil());
 }
 
-static const char *jts_read_lines_fn(void *payload,
-                                     uint32_t byte_index,
-                                     TSPoint position,
-                                     uint32_t *bytes_read) {
-  (void)byte_index;
-  JanetArray *lines = (JanetArray *)payload;
+static void jts_doc_push_nodes(JanetBuffer *buf, JTSPieceNode *node,
+                               uint32_t base, uint32_t from, uint32_t to) {
+  if (NULL == node) {
+    return;
+  }
 
-  uint32_t row = position.row;
-  if (row >= lines->count) {
-    *bytes_read = 0;
-    // XXX: or should this be ""?
-    return NULL;
+  uint32_t start = base + ((NULL != node->left) ? node->left->sum.len : 0);
+  uint32_t end = start + node->piece.len;
+
+  if (from < start) {
+    jts_doc_push_nodes(buf, node->left, base, from, to);
   }
 
-  const char *line = 0;
-  // XXX: keywords and symbols end up being handled by the JANET_STRING case
-  if (janet_checktype(lines->data[row], JANET_BUFFER)) {
-    JanetBuffer *buf = janet_unwrap_buffer(lines->data[row]);
-    line = (const char *)janet_string(buf->data, buf->count);
-  } else if (janet_checktype(lines->data[row], JANET_STRING)) {
-    line = (const char *)janet_unwrap_string(lines->data[row]);
-  } else {
-    // XXX: how to feedback error?
-    janet_panicf("expected buffer or string, got something else");
+  if ((start < to) && (end > from)) {
+    uint32_t lo = (from > start) ? from - start : 0;
+    uint32_t hi = (to < end) ? to - start : node->piece.len;
+    janet_buffer_push_bytes(buf, node->piece.data + lo, (int32_t)(hi - lo));
   }
 
-  uint32_t col = position.column;
-  if (col >= strlen(line)) {
-    *bytes_read = 0;
-    // XXX: or should this be ""?
-    return NULL;
+  if (to > end) {
+    jts_doc_push_nodes(buf, node->right, end, from, to);
   }
+}
 
-  *bytes_read = strlen(line) - col;
-  // XXX: is this ok or is it necessary to somehow copy the data and return
-  //      that instead?  how would one clean that up though?
-  return line + col;
+static void jts_doc_push_range(JTSDocument *doc, JanetBuffer *buf,
+                               uint32_t from, uint32_t to) {
+  if (from < to) {
+    jts_doc_push_nodes(buf, doc->root, 0, from, to);
+  }
 }
 
 /**
- * Use the parser to parse some source code and create a syntax tree.
- *
- * If you are parsing this document for the first time, pass `NULL` for the
- * `old_tree` parameter. Otherwise, if you have already parsed an earlier
- * version of this document and the document has since been edited, pass the
- * previous syntax tree so that the unchanged parts of it can be reused.
- * This will save time and memory. For this to work correctly, you must have
- * already edited the old syntax tree using the `ts_tree_edit` function in a
- * way that exactly matches the source code changes.
- *
- * The `TSInput` parameter lets you specify how to read the text. It has the
- * following three fields:
- * 1. `read`: A function to retrieve a chunk of text at a given byte offset
- *    and (row, column) position. The function should return a pointer to the
- *    text and write its length to the `bytes_read` pointer. The parser does
- *    not take ownership of this buffer; it just borrows it until it has
- *    finished reading it. The function should write a zero value to the
- *    `bytes_read` pointer to indicate the end of the document.
- * 2. `payload`: An arbitrary pointer that will be passed to each invocation
- *    of the `read` function.
- * 3. `encoding`: An indication of how the text is encoded. Either
- *    `TSInputEncodingUTF8` or `TSInputEncodingUTF16`.
- *
- * This function returns a syntax tree on success, and `NULL` on failure. There
- * are three possible reasons for failure:
- * 1. The parser does not have a language assigned. Check for this using the
-      `ts_parser_language` function.
- * 2. Parsing was cancelled due to a timeout that was set by an earlier call to
- *    the `ts_parser_set_timeout_micros` function. You can resume parsing from
- *    where the parser left out by calling `ts_parser_parse` again with the
- *    same arguments. Or you can start parsing from scratch by first calling
- *    `ts_parser_reset`.
- * 3. Parsing was cancelled using a cancellation flag that was set by an
- *    earlier call to `ts_parser_set_cancellation_flag`. You can resume parsing
- *    from where the parser left out by calling `ts_parser_parse` again with
- *    the same arguments.
+ * Get the document's text from `start-byte` up to `end-byte` as a
+ * string.  Suitable for retrieving a node's text.
  */
-static Janet cfun_parser_parse(int32_t argc, Janet *argv) {
+static Janet cfun_document_slice(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 3);
 
-  TSParser **parser_pp = jts_get_parser(argv, 0);
+  JTSDocument *doc = jts_get_document(argv, 0);
+  uint32_t from = (uint32_t)janet_getnat(argv, 1);
+  uint32_t to = (uint32_t)janet_getnat(argv, 2);
+  if ((from > to) || (to > doc->length)) {
+    return janet_wrap_nil();
+  }
 
-  TSTree *old_tree_p = NULL;
+  JanetBuffer *buf = janet_buffer((int32_t)(to - from));
+  jts_doc_push_range(doc, buf, from, to);
 
-  Janet x = argv[1];
-  if (janet_checktype(x, JANET_NIL)) {
-    old_tree_p = NULL;
-  } else if (janet_checktype(x, JANET_ABSTRACT)) {
-    TSTree **temp_tree_pp = jts_get_tree(argv, 1);
-    if (NULL == temp_tree_pp) {
-      return janet_wrap_nil();
-    }
+  return janet_stringv(buf->data, buf->count);
+}
 
-    old_tree_p = *temp_tree_pp;
-  } else {
-    return janet_wrap_nil();
-  }
+/**
+ * Get the document's entire text as a string.
+ */
+static Janet cfun_document_text(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
 
-  JanetArray *lines = janet_getarray(argv, 2);
+  JTSDocument *doc = jts_get_document(argv, 0);
 
-  TSInput input = (TSInput) {
-    .payload = (void *)lines,
-    .read = &jts_read_lines_fn,
-    .encoding = TSInputEncodingUTF8
-  };
+  JanetBuffer *buf = janet_buffer((int32_t)doc->length);
+  jts_doc_push_range(doc, buf, 0, doc->length);
 
-  TSTree *new_tree_p = ts_parser_parse(*parser_pp, old_tree_p, input);
-  if (NULL == new_tree_p) {
-    return janet_wrap_nil();
-  }
+  return janet_stringv(buf->data, buf->count);
+}
 
-  TSTree **tree_pp =
-    (TSTree **)janet_abstract(&jts_tree_type, sizeof(TSTree *));
+/**
+ * Get the document's length in bytes.
+ */
+static Janet cfun_document_byte_count(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
 
-  *tree_pp = new_tree_p;
+  JTSDocument *doc = jts_get_document(argv, 0);
 
-  return janet_wrap_abstract(tree_pp);
+  return janet_wrap_number((double)doc->length);
 }
 
 /**
- * Use the parser to parse some source code stored in one contiguous buffer.
- * The first two parameters are the same as in the `ts_parser_parse` function
- * above. The second two parameters indicate the location of the buffer and its
- * length in bytes.
+ * Get the row and column of a byte offset in the document.
  */
-static Janet cfun_parser_parse_string(int32_t argc, Janet *argv) {
-  janet_arity(argc, 2, 3);
+static Janet cfun_document_point_for_byte(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
 
-  TSParser **parser_pp = jts_get_parser(argv, 0);
+  JTSDocument *doc = jts_get_document(argv, 0);
+  uint32_t byte = (uint32_t)janet_getnat(argv, 1);
+  if (byte > doc->length) {
+    return janet_wrap_nil();
+  }
 
-  TSTree *old_tree_p = NULL;
+  TSPoint point = jts_doc_point_for_byte(doc, byte);
 
-  int32_t s_idx = 0;
+  Janet *tup = janet_tuple_begin(2);
+  tup[0] = janet_wrap_integer(point.row);
+  tup[1] = janet_wrap_integer(point.column);
 
-  if (argc == 2) {
-    s_idx = 1;
-  } else {
-    TSTree **temp_tree_pp = jts_get_tree(argv, 1);
-    if (NULL == temp_tree_pp) {
-      return janet_wrap_nil();
-    }
+  return janet_wrap_tuple(janet_tuple_end(tup));
+}
 
-    old_tree_p = *temp_tree_pp;
+static const JanetMethod document_methods[] = {
+  {"apply-edit", cfun_document_apply_edit},
+  {"tree", cfun_document_tree},
+  {"slice", cfun_document_slice},
+  {"text", cfun_document_text},
+  {"byte-count", cfun_document_byte_count},
+  {"point-for-byte", cfun_document_point_for_byte},
+  {NULL, NULL}
+};
 
-    s_idx = 2;
-  }
+static int jts_document_gc(void *p, size_t size) {
+  (void) size;
 
-  const char *src = (const char *)janet_getstring(argv, s_idx);
-  if (NULL == src) {
-    return janet_wrap_nil();
+  JTSDocument *doc = (JTSDocument *)p;
+  if (NULL != doc->tree) {
+    ts_tree_delete(doc->tree);
+    doc->tree = NULL;
   }
 
-  TSTree *new_tree_p =
-    ts_parser_parse_string(*parser_pp, (const TSTree *)old_tree_p,
-                           src, (uint32_t)strlen(src));
-  if (NULL == new_tree_p) {
-    return janet_wrap_nil();
+  JTSDocBlock *block = doc->blocks;
+  while (NULL != block) {
+    JTSDocBlock *next = block->next;
+    free(block);
+    block = next;
   }
+  doc->blocks = NULL;
 
-  TSTree **tree_pp =
-    (TSTree **)janet_abstract(&jts_tree_type, sizeof(TSTree *));
+  jts_doc_free_nodes(doc->root);
+  doc->root = NULL;
 
-  *tree_pp = new_tree_p;
+  free(doc->original);
+  free(doc->original_nls);
+  doc->original = NULL;
+  doc->original_nls = NULL;
 
-  return janet_wrap_abstract(tree_pp);
+  return 0;
 }
 
-void log_by_eprint(void *payload, TSLogType type, const char *message) {
-  (void)payload;
-  if (type == TSLogTypeLex) {
-    janet_eprintf("  %s\n", message);
-  } else {
-    janet_eprintf("%s\n", message);
+static int jts_document_gcmark(void *p, size_t size) {
+  (void) size;
+
+  JTSDocument *doc = (JTSDocument *)p;
+  janet_mark(doc->parser);
+
+  return 0;
+}
+
+static int jts_document_get(void *p, Janet key, Janet *out) {
+  (void) p;
+
+  if (!janet_checktype(key, JANET_KEYWORD)) {
+    return 0;
   }
+
+  return janet_getmethod(janet_unwrap_keyword(key), document_methods, out);
 }
 
-static Janet cfun_parser_log_by_eprint(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 1);
+////////
+
+// run `fn` on up to `n_threads` threads, the calling thread being one of
+// them.  workers pull items from a shared counter, so if fewer threads
+// could be started the remaining ones still finish all of the work.
+static void jts_run_workers(int32_t n_threads, JTSThreadFn fn, void *arg) {
+  JTSThread *threads = NULL;
+  int32_t started = 0;
+
+  if (n_threads > 1) {
+    threads = (JTSThread *)malloc(sizeof(JTSThread) * (n_threads - 1));
+  }
 
-  TSParser **parser_pp = jts_get_parser(argv, 0);
+  if (NULL != threads) {
+    for (int32_t i = 0; i < n_threads - 1; i++) {
+      if (0 != jts_thread_create(&threads[started], fn, arg)) {
+        break;
+      }
+      started++;
+    }
+  }
 
-  TSLogger logger = {*parser_pp, log_by_eprint};
+  (void)fn(arg);
 
-  ts_parser_set_logger(*parser_pp, logger);
+  for (int32_t i = 0; i < started; i++) {
+    jts_thread_join(threads[i]);
+  }
 
-  return janet_wrap_nil();
+  free(threads);
 }
 
-static Janet cfun_parser_print_dot_graphs_0(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 2);
+static int32_t jts_worker_count(const Janet *argv, int32_t argc, int32_t n,
+                                int32_t n_items) {
+  int32_t n_threads = janet_optnat(argv, argc, n, 0);
+  if (0 == n_threads) {
+    n_threads = jts_cpu_count();
+  }
 
-  TSParser **parser_pp = jts_get_parser(argv, 0);
+  if (n_threads > n_items) {
+    n_threads = n_items;
+  }
 
-  // XXX: is this safe?
-  JanetFile *of =
-    (JanetFile *)janet_getabstract(argv, 1, &janet_file_type);
-  if (NULL == of) {
-    return janet_wrap_nil();
+  return (n_threads < 1) ? 1 : n_threads;
+}
+
+static char *jts_read_file(const char *path, uint32_t *len) {
+  FILE *f = fopen(path, "rb");
+  if (NULL == f) {
+    return NULL;
   }
 
-  // XXX: check of->flags to make sure writable?
-  //      what about append, etc.?
-  if (!(of->flags & JANET_FILE_WRITE)) {
-    return janet_wrap_nil();
+  char *data = NULL;
+  long size = 0;
+  if ((0 == fseek(f, 0, SEEK_END)) &&
+      ((size = ftell(f)) >= 0) &&
+      ((uint64_t)size <= UINT32_MAX) &&
+      (0 == fseek(f, 0, SEEK_SET))) {
+    data = (char *)malloc((size_t)size + 1);
+    if ((NULL != data) && ((size_t)size != fread(data, 1, (size_t)size, f))) {
+      free(data);
+      data = NULL;
+    }
   }
 
-  // XXX: britle?
-  // XXX: ended up including portions of parser.c near beginning
-  //      of this file to get this working...
-  (*parser_pp)->dot_graph_file = of->file;
+  (void)fclose(f);
 
-  // XXX: more useful than nil as a return value?
-  return janet_wrap_true();
+  *len = (uint32_t)size;
+
+  return data;
 }
 
-static const JanetMethod parser_methods[] = {
-  //{"new", cfun_parser_new},
-  //{"delete", cfun_parser_delete},
-  //{"set-language", cfun_parser_set_language},
-  {"language", cfun_parser_language},
-  //{"set-included-ranges", cfun_parser_set_included_ranges},
-  //{"included-ranges", cfun_parser_included_ranges},
-  {"parse", cfun_parser_parse},
-  {"parse-string", cfun_parser_parse_string},
-  //{"parse-string-encoding", cfun_parser_parse_string_encoding},
-  //{"reset", cfun_parser_reset},
-  //{"set-timeout-micros", cfun_parser_set_timeout_micros},
-  //{"timeout-micros", cfun_parser_timeout_micros},
-  //{"set-cancellation-flag", cfun_parser_set_cancellation_flag},
-  //{"cancellation-flag", cfun_parser_cancellation_flag},
-  //{"set-logger", cfun_parser_set_logger},
-  //{"logger", cfun_parser_logger},
-  //{"print-dot-graphs", cfun_parser_print_dot_graphs},
-  // custom
-  {"print-dot-graphs-0", cfun_parser_print_dot_graphs_0},
-  {"log-by-eprint", cfun_parser_log_by_eprint},
-  {NULL, NULL}
-};
+typedef struct {
+  const TSLanguage *language;
+  int from_files;
+  int32_t count;
+  const uint8_t **items;
+  uint32_t *lens;
+  TSTree **trees;
+  int32_t next;
+} JTSParseBatch;
+
+static JTS_THREAD_FN(jts_parse_batch_worker, arg) {
+  JTSParseBatch *batch = (JTSParseBatch *)arg;
+
+  TSParser *parser = ts_parser_new();
+  if ((NULL == parser) || !ts_parser_set_language(parser, batch->language)) {
+    if (NULL != parser) {
+      ts_parser_delete(parser);
+    }
+    return JTS_THREAD_RESULT;
+  }
 
-static int jts_parser_gc(void *p, size_t size) {
-  (void) size;
+  while (1) {
+    int32_t i = (int32_t)jts_atomic_inc(&batch->next) - 1;
+    if (i >= batch->count) {
+      break;
+    }
 
-  TSParser **parser_pp = (TSParser **)p;
-  if (*parser_pp != NULL) {
-    ts_parser_delete(*parser_pp);
-    *parser_pp = NULL;
+    if (batch->from_files) {
+      uint32_t len = 0;
+      char *data = jts_read_file((const char *)batch->items[i], &len);
+      if (NULL != data) {
+        batch->trees[i] = ts_parser_parse_string(parser, NULL, data, len);
+        free(data);
+      }
+    } else {
+      batch->trees[i] =
+        ts_parser_parse_string(parser, NULL,
+                               (const char *)batch->items[i],
+                               batch->lens[i]);
+    }
   }
 
-  return 0;
+  ts_parser_delete(parser);
+
+  return JTS_THREAD_RESULT;
 }
 
-static int jts_parser_get(void *p, Janet key, Janet *out) {
-  (void) p;
+/**
+ * Parse many sources (or files) with `lang` on a pool of worker threads,
+ * each with its own parser.
+ *
+ * `items` is an array / tuple of strings or buffers holding source
+ * code, or, if `from-files` is truthy, of file paths.  `n-threads`
+ * defaults to the number of processors.  Returns an array of trees in
+ * the same order as `items`, with nil where parsing (or reading a file)
+ * failed.
+ */
+static Janet cfun_parse_batch(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 4);
 
-  if (!janet_checktype(key, JANET_KEYWORD)) {
-    return 0;
+  TSLanguage **lang_pp = jts_get_language(argv, 0);
+  JanetView view = janet_getindexed(argv, 1);
+  int from_files = (argc > 3) && janet_truthy(argv[3]);
+
+  int32_t count = view.len;
+  int32_t n_threads = jts_worker_count(argv, argc, 2, count);
+
+  JTSParseBatch batch;
+  batch.language = *lang_pp;
+  batch.from_files = from_files;
+  batch.count = count;
+  batch.next = 0;
+  batch.items = (const uint8_t **)malloc(sizeof(uint8_t *) * (count + 1));
+  batch.lens = (uint32_t *)malloc(sizeof(uint32_t) * (count + 1));
+  batch.trees = (TSTree **)calloc((size_t)count + 1, sizeof(TSTree *));
+  if ((NULL == batch.items) || (NULL == batch.lens) || (NULL == batch.trees)) {
+    free(batch.items);
+    free(batch.lens);
+    free(batch.trees);
+    janet_panic("failed to allocate batch");
   }
 
-  return janet_getmethod(janet_unwrap_keyword(key), parser_methods, out);
+  for (int32_t i = 0; i < count; i++) {
+    const uint8_t *bytes = NULL;
+    int32_t len = 0;
+    // paths are handed to fopen, so they must be (NUL-terminated) strings
+    int ok = from_files
+             ? janet_checktype(view.items[i], JANET_STRING)
+             : janet_bytes_view(view.items[i], &bytes, &len);
+    if (!ok) {
+      free(batch.items);
+      free(batch.lens);
+      free(batch.trees);
+      janet_panicf("item %d: expected %s, got %v",
+                   i, from_files ? "string path" : "string or buffer",
+                   view.items[i]);
+    }
+    if (from_files) {
+      bytes = janet_unwrap_string(view.items[i]);
+    }
+    batch.items[i] = bytes;
+    batch.lens[i] = (uint32_t)len;
+  }
+
+  // the janet values being read stay put as this thread is blocked until
+  // all workers are done
+  jts_run_workers(n_threads, jts_parse_batch_worker, &batch);
+
+  JanetArray *results = janet_array(count);
+  for (int32_t i = 0; i < count; i++) {
+    if (NULL == batch.trees[i]) {
+      janet_array_push(results, janet_wrap_nil());
+    } else {
+      janet_array_push(results, jts_wrap_tree(batch.trees[i], janet_wrap_nil()));
+    }
+  }
+
+  free(batch.items);
+  free(batch.lens);
+  free(batch.trees);
+
+  return janet_wrap_array(results);
 }
 
 ////////
 
-static TSTreeCursor *jts_get_cursor(const Janet *argv, int32_t n) {
-  return (TSTreeCursor *)janet_getabstract(argv, n, &jts_cursor_type);
+static JTSCursor *jts_get_cursor(const Janet *argv, int32_t n) {
+  return (JTSCursor *)janet_getabstract(argv, n, &jts_cursor_type);
 }
 
 /**
@@ -1292,17 +5651,18 @@ static TSTreeCursor *jts_get_cursor(const Janet *argv, int32_t n) {
 static Janet cfun_cursor_new(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
 
-  TSNode node = *jts_get_node(argv, 0);
-  if (ts_node_is_null(node)) {
+  JTSNode *node_p = jts_get_node(argv, 0);
+  if (ts_node_is_null(node_p->node)) {
     return janet_wrap_nil();
   }
 
-  TSTreeCursor c = ts_tree_cursor_new(node);
+  TSTreeCursor c = ts_tree_cursor_new(node_p->node);
   // XXX: can't fail?
 
-  TSTreeCursor *cursor_p =
-    (TSTreeCursor *)janet_abstract(&jts_cursor_type, sizeof(TSTreeCursor));
-  *cursor_p = c;
+  JTSCursor *cursor_p =
+    (JTSCursor *)janet_abstract(&jts_cursor_type, sizeof(JTSCursor));
+  cursor_p->cursor = c;
+  cursor_p->tree = node_p->tree;
 
   return janet_wrap_abstract(cursor_p);
 }
@@ -1313,15 +5673,16 @@ static Janet cfun_cursor_new(int32_t argc, Janet *argv) {
 static Janet cfun_cursor_reset(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 2);
 
-  TSTreeCursor *cursor_p = jts_get_cursor(argv, 0);
+  JTSCursor *cursor_p = jts_get_cursor(argv, 0);
   // XXX: error checking?
 
-  TSNode node = *jts_get_node(argv, 1);
-  if (ts_node_is_null(node)) {
+  JTSNode *node_p = jts_get_node(argv, 1);
+  if (ts_node_is_null(node_p->node)) {
     return janet_wrap_nil();
   }
 
-  ts_tree_cursor_reset(cursor_p, node);
+  ts_tree_cursor_reset(&cursor_p->cursor, node_p->node);
+  cursor_p->tree = node_p->tree;
 
   // XXX: better to return true?
   return janet_wrap_nil();
@@ -1333,38 +5694,64 @@ static Janet cfun_cursor_reset(int32_t argc, Janet *argv) {
 static Janet cfun_cursor_current_node(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
 
-  TSTreeCursor *cursor_p = jts_get_cursor(argv, 0);
+  JTSCursor *cursor_p = jts_get_cursor(argv, 0);
   // XXX: error checking?
 
-  TSNode *node_p =
-    (TSNode *)janet_abstract(&jts_node_type, sizeof(TSNode));
+  return jts_wrap_node(ts_tree_cursor_current_node(&cursor_p->cursor),
+                       cursor_p->tree);
+}
+
+/**
+ * Get the field name of the tree cursor's current node.
+ *
+ * This returns `NULL` if the current node doesn't have a field.
+ * See also `ts_node_child_by_field_name`.
+ */
+static Janet cfun_cursor_current_field_name(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSCursor *cursor_p = jts_get_cursor(argv, 0);
+  // XXX: error checking?
 
-  *node_p = ts_tree_cursor_current_node(cursor_p);
-  if (ts_node_is_null(*node_p)) {
+  const char *name = ts_tree_cursor_current_field_name(&cursor_p->cursor);
+  if (NULL == name) {
     return janet_wrap_nil();
   }
 
-  return janet_wrap_abstract(node_p);
+  return janet_cstringv(name);
 }
 
 /**
- * Get the field name of the tree cursor's current node.
+ * Get the field id of the tree cursor's current node.
  *
- * This returns `NULL` if the current node doesn't have a field.
- * See also `ts_node_child_by_field_name`.
+ * This returns nil if the current node doesn't have a field.
+ * See also `ts_node_child_by_field_id`, `ts_language_field_id_for_name`.
+ */
+static Janet cfun_cursor_current_field_id(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSCursor *cursor_p = jts_get_cursor(argv, 0);
+
+  TSFieldId id = ts_tree_cursor_current_field_id(&cursor_p->cursor);
+  if (0 == id) {
+    return janet_wrap_nil();
+  }
+
+  return janet_wrap_integer(id);
+}
+
+/**
+ * Get the symbol id of the tree cursor's current node without creating
+ * a node.
  */
-static Janet cfun_cursor_current_field_name(int32_t argc, Janet *argv) {
+static Janet cfun_cursor_current_symbol(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
 
-  TSTreeCursor *cursor_p = jts_get_cursor(argv, 0);
-  // XXX: error checking?
+  JTSCursor *cursor_p = jts_get_cursor(argv, 0);
 
-  const char *name = ts_tree_cursor_current_field_name(cursor_p);
-  if (NULL == name) {
-    return janet_wrap_nil();
-  }
+  TSNode node = ts_tree_cursor_current_node(&cursor_p->cursor);
 
-  return janet_cstringv(name);
+  return janet_wrap_integer(ts_node_symbol(node));
 }
 
 /**
@@ -1376,10 +5763,10 @@ static Janet cfun_cursor_current_field_name(int32_t argc, Janet *argv) {
 static Janet cfun_cursor_goto_parent(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
 
-  TSTreeCursor *cursor_p = jts_get_cursor(argv, 0);
+  JTSCursor *cursor_p = jts_get_cursor(argv, 0);
   // XXX: error checking?
 
-  if (ts_tree_cursor_goto_parent(cursor_p)) {
+  if (ts_tree_cursor_goto_parent(&cursor_p->cursor)) {
     return janet_wrap_true();
   }
 
@@ -1395,10 +5782,10 @@ static Janet cfun_cursor_goto_parent(int32_t argc, Janet *argv) {
 static Janet cfun_cursor_goto_next_sibling(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
 
-  TSTreeCursor *cursor_p = jts_get_cursor(argv, 0);
+  JTSCursor *cursor_p = jts_get_cursor(argv, 0);
   // XXX: error checking?
 
-  if (ts_tree_cursor_goto_next_sibling(cursor_p)) {
+  if (ts_tree_cursor_goto_next_sibling(&cursor_p->cursor)) {
     return janet_wrap_true();
   }
 
@@ -1414,28 +5801,121 @@ static Janet cfun_cursor_goto_next_sibling(int32_t argc, Janet *argv) {
 static Janet cfun_cursor_goto_first_child(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
 
-  TSTreeCursor *cursor_p = jts_get_cursor(argv, 0);
+  JTSCursor *cursor_p = jts_get_cursor(argv, 0);
   // XXX: error checking?
 
-  if (ts_tree_cursor_goto_first_child(cursor_p)) {
+  if (ts_tree_cursor_goto_first_child(&cursor_p->cursor)) {
     return janet_wrap_true();
   }
 
   return janet_wrap_false();
 }
 
+/**
+ * Move the cursor to the first child of its current node that extends beyond
+ * the given byte offset.
+ *
+ * This returns the index of the child node if one was found, and returns nil
+ * if no such child was found.
+ */
+static Janet cfun_cursor_goto_first_child_for_byte(int32_t argc,
+                                                   Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSCursor *cursor_p = jts_get_cursor(argv, 0);
+  uint32_t byte = (uint32_t)janet_getnat(argv, 1);
+
+  int64_t idx =
+    ts_tree_cursor_goto_first_child_for_byte(&cursor_p->cursor, byte);
+  if (idx < 0) {
+    return janet_wrap_nil();
+  }
+
+  return janet_wrap_number((double)idx);
+}
+
+/**
+ * Move the cursor to the first child of its current node that extends beyond
+ * the given point.
+ *
+ * This returns the index of the child node if one was found, and returns nil
+ * if no such child was found.
+ */
+static Janet cfun_cursor_goto_first_child_for_point(int32_t argc,
+                                                    Janet *argv) {
+  janet_fixarity(argc, 3);
+
+  JTSCursor *cursor_p = jts_get_cursor(argv, 0);
+  TSPoint point = (TSPoint) {
+    (uint32_t)janet_getnat(argv, 1), (uint32_t)janet_getnat(argv, 2)
+  };
+
+  int64_t idx =
+    ts_tree_cursor_goto_first_child_for_point(&cursor_p->cursor, point);
+  if (idx < 0) {
+    return janet_wrap_nil();
+  }
+
+  return janet_wrap_number((double)idx);
+}
+
+/**
+ * Move the cursor down from its current node to the deepest descendant
+ * containing the given byte offset, so that the cursor's ancestors form
+ * the path to it.  Returns the number of levels descended.
+ *
+ * If `buf` is given, a packed record (as for a node's `children`) is
+ * appended to it for each node moved to, outermost first, with points
+ * if `with-points` is truthy.
+ */
+static Janet cfun_cursor_goto_descendant_for_byte(int32_t argc,
+                                                  Janet *argv) {
+  janet_arity(argc, 2, 4);
+
+  JTSCursor *cursor_p = jts_get_cursor(argv, 0);
+  uint32_t byte = (uint32_t)janet_getnat(argv, 1);
+
+  JanetBuffer *buf = NULL;
+  if ((argc > 2) && !janet_checktype(argv[2], JANET_NIL)) {
+    buf = janet_getbuffer(argv, 2);
+  }
+  int with_points = (argc > 3) && janet_truthy(argv[3]);
+
+  TSTreeCursor *c = &cursor_p->cursor;
+
+  int32_t depth = 0;
+  while (ts_tree_cursor_goto_first_child_for_byte(c, byte) >= 0) {
+    TSNode node = ts_tree_cursor_current_node(c);
+    // the child may start after `byte`, e.g. when `byte` is whitespace
+    if (ts_node_start_byte(node) > byte) {
+      ts_tree_cursor_goto_parent(c);
+      break;
+    }
+    if (NULL != buf) {
+      jts_push_node_record(buf, node, ts_tree_cursor_current_field_id(c),
+                           with_points);
+    }
+    depth++;
+  }
+
+  return janet_wrap_integer(depth);
+}
+
 static const JanetMethod cursor_methods[] = {
   //{"delete", cfun_cursor_delete},
   {"reset", cfun_cursor_reset},
   {"current-node", cfun_cursor_current_node},
   {"current-field-name", cfun_cursor_current_field_name},
-  //{"current-field-id", cfun_cursor_current_field_id},
+  {"current-field-id", cfun_cursor_current_field_id},
   {"goto-parent", cfun_cursor_goto_parent},
   {"goto-next-sibling", cfun_cursor_goto_next_sibling},
   {"goto-first-child", cfun_cursor_goto_first_child},
-  //{"goto-first-child-for-byte", cfun_cursor_goto_first_child_for_byte},
-  //{"goto-first-child-for-point", cfun_cursor_goto_first_child_for_point},
+  {"goto-first-child-for-byte", cfun_cursor_goto_first_child_for_byte},
+  {"goto-first-child-for-point", cfun_cursor_goto_first_child_for_point},
   //{"copy", cfun_cursor_copy},
+  // custom
+  {"current-symbol", cfun_cursor_current_symbol},
+  {"goto-descendant-for-byte", cfun_cursor_goto_descendant_for_byte},
   // custom - convenience aliases
   {"node", cfun_cursor_current_node},
   {"field-name", cfun_cursor_current_field_name},
@@ -1448,15 +5928,24 @@ static const JanetMethod cursor_methods[] = {
 static int jts_cursor_gc(void *p, size_t size) {
   (void) size;
 
-  TSTreeCursor *cursor_p = (TSTreeCursor *)p;
+  JTSCursor *cursor_p = (JTSCursor *)p;
   if (cursor_p != NULL) {
-    ts_tree_cursor_delete(cursor_p);
+    ts_tree_cursor_delete(&cursor_p->cursor);
     cursor_p = NULL;
   }
 
   return 0;
 }
 
+static int jts_cursor_gcmark(void *p, size_t size) {
+  (void) size;
+
+  JTSCursor *cursor_p = (JTSCursor *)p;
+  janet_mark(cursor_p->tree);
+
+  return 0;
+}
+
 static int jts_cursor_get(void *p, Janet key, Janet *out) {
   (void) p;
 
@@ -1469,10 +5958,488 @@ static int jts_cursor_get(void *p, Janet key, Janet *out) {
 
 ////////
 
-static TSQuery **jts_get_query(const Janet *argv, uint32_t n) {
-  return (TSQuery **)janet_getabstract(argv, (int32_t)n, &jts_query_type);
+static JTSQuery *jts_get_query(const Janet *argv, uint32_t n) {
+  return *(JTSQuery **)janet_getabstract(argv, (int32_t)n, &jts_query_type);
+}
+
+// kind of the text predicate named `op` (without its leading #), or -1
+// if query cursors leave it to the caller.  without regular expressions
+// (e.g. on windows), #match? is one of those.
+static int jts_predicate_kind(const char *op, int *negate) {
+  *negate = 0;
+  if (0 == strncmp(op, "not-", 4)) {
+    *negate = 1;
+    op += 4;
+  }
+
+  if (0 == strcmp(op, "eq?")) {
+    return JTS_PRED_EQ;
+  } else if (0 == strcmp(op, "any-of?")) {
+    return JTS_PRED_ANY_OF;
+#if JTS_HAVE_REGEX
+  } else if (0 == strcmp(op, "match?")) {
+    return JTS_PRED_MATCH;
+#endif
+  }
+
+  return -1;
+}
+
+#if JTS_HAVE_REGEX
+/**
+ * Translate the escapes \d \s \w (and their negations) that query
+ * regexes commonly use into POSIX extended regex syntax.  Everything
+ * else is copied as is.  Returns a malloc'd string or NULL.
+ */
+static char *jts_regex_to_posix(const char *src, uint32_t len) {
+  // a two-byte escape expands to at most 13 bytes
+  char *out = (char *)malloc((size_t)len * 8 + 1);
+  if (NULL == out) {
+    return NULL;
+  }
+
+  size_t o = 0;
+  int in_class = 0;
+  for (uint32_t i = 0; i < len; i++) {
+    char c = src[i];
+    if (('\\' == c) && (i + 1 < len)) {
+      char e = src[++i];
+      const char *rep = NULL;
+      if (in_class) {
+        switch (e) {
+          case 'd': rep = "[:digit:]"; break;
+          case 's': rep = "[:space:]"; break;
+          case 'w': rep = "[:alnum:]_"; break;
+          default: break;
+        }
+      } else {
+        switch (e) {
+          case 'd': rep = "[[:digit:]]"; break;
+          case 'D': rep = "[^[:digit:]]"; break;
+          case 's': rep = "[[:space:]]"; break;
+          case 'S': rep = "[^[:space:]]"; break;
+          case 'w': rep = "[[:alnum:]_]"; break;
+          case 'W': rep = "[^[:alnum:]_]"; break;
+          default: break;
+        }
+      }
+      if (NULL != rep) {
+        size_t rep_len = strlen(rep);
+        memcpy(out + o, rep, rep_len);
+        o += rep_len;
+      } else if (in_class) {
+        // backslash is literal in POSIX bracket expressions
+        out[o++] = e;
+      } else {
+        out[o++] = '\\';
+        out[o++] = e;
+      }
+      continue;
+    }
+    if (!in_class && ('[' == c)) {
+      in_class = 1;
+      out[o++] = c;
+      // a leading ^ and / or ] belong to the class
+      if ((i + 1 < len) && ('^' == src[i + 1])) {
+        out[o++] = src[++i];
+      }
+      if ((i + 1 < len) && (']' == src[i + 1])) {
+        out[o++] = src[++i];
+      }
+      continue;
+    }
+    if (in_class && ('[' == c) && (i + 1 < len) && (':' == src[i + 1])) {
+      // character class name such as [:alpha:]
+      const char *end = strstr(src + i + 2, ":]");
+      if ((NULL != end) && (end + 2 <= src + len)) {
+        size_t n = (size_t)(end + 2 - (src + i));
+        memcpy(out + o, src + i, n);
+        o += n;
+        i += (uint32_t)n - 1;
+        continue;
+      }
+    }
+    if (in_class && (']' == c)) {
+      in_class = 0;
+    }
+    out[o++] = c;
+  }
+  out[o] = '\0';
+
+  return out;
+}
+#endif
+
+static const char *jts_query_string(const JTSQuery *q, uint32_t id,
+                                    uint32_t *len) {
+  return ts_query_string_value_for_id(q->query, id, len);
+}
+
+/**
+ * Compile the text predicates (#eq?, #not-eq?, #match?, #not-match?,
+ * #any-of?, #not-any-of?) of every pattern.  Other predicates, e.g.
+ * directives such as #set!, are left to the caller.
+ *
+ * Returns 0 on success, otherwise describes the problem in `err`.  What
+ * was compiled so far is released by `jts_query_free`.
+ */
+static int jts_query_compile_predicates(JTSQuery *q,
+                                        char *err, size_t err_size) {
+  uint32_t pattern_count = ts_query_pattern_count(q->query);
+
+  q->pattern_starts =
+    (uint32_t *)calloc((size_t)pattern_count + 1, sizeof(uint32_t));
+  if (NULL == q->pattern_starts) {
+    snprintf(err, err_size, "failed to allocate query predicates");
+    return -1;
+  }
+
+  // an upper bound: every predicate has at least two steps
+  uint32_t capacity = 0;
+  for (uint32_t i = 0; i < pattern_count; i++) {
+    uint32_t n_steps = 0;
+    (void)ts_query_predicates_for_pattern(q->query, i, &n_steps);
+    capacity += n_steps / 2;
+  }
+  q->predicates =
+    (JTSPredicate *)calloc((size_t)capacity + 1, sizeof(JTSPredicate));
+  if (NULL == q->predicates) {
+    snprintf(err, err_size, "failed to allocate query predicates");
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < pattern_count; i++) {
+    q->pattern_starts[i] = q->predicate_count;
+
+    uint32_t n_steps = 0;
+    const TSQueryPredicateStep *steps =
+      ts_query_predicates_for_pattern(q->query, i, &n_steps);
+
+    uint32_t start = 0;
+    while (start < n_steps) {
+      uint32_t end = start;
+      while ((end < n_steps) &&
+             (TSQueryPredicateStepTypeDone != steps[end].type)) {
+        end++;
+      }
+      uint32_t n_args = (end > start) ? end - start - 1 : 0;
+      const TSQueryPredicateStep *args = steps + start + 1;
+
+      if ((end > start) &&
+          (TSQueryPredicateStepTypeString == steps[start].type)) {
+        // the name as written, e.g. not-eq?, for error messages
+        uint32_t op_len = 0;
+        const char *op = jts_query_string(q, steps[start].value_id, &op_len);
+
+        JTSPredicate pred;
+        memset(&pred, 0, sizeof(JTSPredicate));
+        pred.other_capture_id = -1;
+        pred.kind = jts_predicate_kind(op, &pred.negate);
+
+        if (pred.kind >= 0) {
+          if ((n_args < 2) ||
+              (TSQueryPredicateStepTypeCapture != args[0].type) ||
+              ((JTS_PRED_ANY_OF != pred.kind) && (2 != n_args))) {
+            snprintf(err, err_size, "wrong arguments to #%s in pattern %u",
+                     op, i);
+            return -1;
+          }
+          pred.capture_id = args[0].value_id;
+
+          if ((JTS_PRED_EQ == pred.kind) &&
+              (TSQueryPredicateStepTypeCapture == args[1].type)) {
+            pred.other_capture_id = args[1].value_id;
+          } else {
+            pred.value_ids =
+              (uint32_t *)malloc(sizeof(uint32_t) * (n_args - 1));
+            if (NULL == pred.value_ids) {
+              snprintf(err, err_size, "failed to allocate query predicates");
+              return -1;
+            }
+            for (uint32_t j = 1; j < n_args; j++) {
+              if (TSQueryPredicateStepTypeString != args[j].type) {
+                free(pred.value_ids);
+                snprintf(err, err_size, "#%s in pattern %u expects strings",
+                         op, i);
+                return -1;
+              }
+              pred.value_ids[pred.value_count++] = args[j].value_id;
+            }
+          }
+
+#if JTS_HAVE_REGEX
+          if (JTS_PRED_MATCH == pred.kind) {
+            uint32_t re_len = 0;
+            const char *re = jts_query_string(q, pred.value_ids[0], &re_len);
+            char *posix = jts_regex_to_posix(re, re_len);
+            int failed = (NULL == posix) ||
+                         (0 != regcomp(&pred.regex, posix,
+                                       REG_EXTENDED | REG_NOSUB));
+            free(posix);
+            if (failed) {
+              free(pred.value_ids);
+              snprintf(err, err_size, "invalid regex in pattern %u: %s",
+                       i, re);
+              return -1;
+            }
+            pred.has_regex = 1;
+          }
+#endif
+
+          q->predicates[q->predicate_count++] = pred;
+        }
+      }
+
+      start = end + 1;
+    }
+  }
+
+  q->pattern_starts[pattern_count] = q->predicate_count;
+
+  return 0;
+}
+
+static void jts_query_free(JTSQuery *q) {
+  for (uint32_t i = 0; i < q->predicate_count; i++) {
+    JTSPredicate *pred = &q->predicates[i];
+    free(pred->value_ids);
+#if JTS_HAVE_REGEX
+    if (pred->has_regex) {
+      regfree(&pred->regex);
+    }
+#endif
+  }
+  free(q->predicates);
+  free(q->pattern_starts);
+  if (NULL != q->query) {
+    ts_query_delete(q->query);
+  }
+  free(q);
+}
+
+static void jts_query_release(JTSQuery *q) {
+  if (0 == jts_atomic_dec(&q->refcount)) {
+    jts_query_free(q);
+  }
+}
+
+//////// start query cache ////////
+
+// compiled queries are immutable, so one compiled query is shared by
+// every query abstract (and thread) asking for the same language and
+// source.  the cache holds a reference to each of its entries and
+// evicts the least recently used entry beyond its capacity.
+
+typedef struct JTSQueryCacheEntry {
+  struct JTSQueryCacheEntry *prev;
+  struct JTSQueryCacheEntry *next;
+  const TSLanguage *language;
+  uint64_t hash;
+  char *source;
+  uint32_t source_len;
+  JTSQuery *query;
+} JTSQueryCacheEntry;
+
+static JTSMutex jts_query_cache_lock = JTS_MUTEX_INIT;
+// most recently used first
+static JTSQueryCacheEntry *jts_query_cache_head = NULL;
+static JTSQueryCacheEntry *jts_query_cache_tail = NULL;
+static size_t jts_query_cache_capacity = 64;
+static size_t jts_query_cache_count = 0;
+static size_t jts_query_cache_bytes = 0;
+static size_t jts_query_cache_hits = 0;
+static size_t jts_query_cache_misses = 0;
+
+// FNV-1a
+static uint64_t jts_hash_bytes(const char *data, uint32_t len) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (uint32_t i = 0; i < len; i++) {
+    hash ^= (uint8_t)data[i];
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+// the caller holds the lock
+static void jts_query_cache_unlink(JTSQueryCacheEntry *e) {
+  if (NULL != e->prev) {
+    e->prev->next = e->next;
+  } else {
+    jts_query_cache_head = e->next;
+  }
+  if (NULL != e->next) {
+    e->next->prev = e->prev;
+  } else {
+    jts_query_cache_tail = e->prev;
+  }
+  e->prev = NULL;
+  e->next = NULL;
+}
+
+// the caller holds the lock
+static void jts_query_cache_push_front(JTSQueryCacheEntry *e) {
+  e->prev = NULL;
+  e->next = jts_query_cache_head;
+  if (NULL != jts_query_cache_head) {
+    jts_query_cache_head->prev = e;
+  }
+  jts_query_cache_head = e;
+  if (NULL == jts_query_cache_tail) {
+    jts_query_cache_tail = e;
+  }
+}
+
+// the caller holds the lock.  evicted queries are appended to `evicted`
+// to be released after unlocking.
+static void jts_query_cache_trim(JTSQuery **evicted, size_t *n_evicted) {
+  while (jts_query_cache_count > jts_query_cache_capacity) {
+    JTSQueryCacheEntry *e = jts_query_cache_tail;
+    jts_query_cache_unlink(e);
+    jts_query_cache_count--;
+    jts_query_cache_bytes -= e->source_len;
+    evicted[(*n_evicted)++] = e->query;
+    free(e->source);
+    free(e);
+  }
+}
+
+// returns a new reference to a cached query, or NULL
+static JTSQuery *jts_query_cache_lookup(const TSLanguage *language,
+                                        uint64_t hash,
+                                        const char *source,
+                                        uint32_t source_len) {
+  JTSQuery *found = NULL;
+
+  jts_mutex_lock(&jts_query_cache_lock);
+  for (JTSQueryCacheEntry *e = jts_query_cache_head; NULL != e; e = e->next) {
+    if ((e->language == language) && (e->hash == hash) &&
+        (e->source_len == source_len) &&
+        (0 == memcmp(e->source, source, source_len))) {
+      jts_query_cache_unlink(e);
+      jts_query_cache_push_front(e);
+      jts_atomic_inc(&e->query->refcount);
+      found = e->query;
+      break;
+    }
+  }
+  if (NULL != found) {
+    jts_query_cache_hits++;
+  } else {
+    jts_query_cache_misses++;
+  }
+  jts_mutex_unlock(&jts_query_cache_lock);
+
+  return found;
+}
+
+// adds a reference to `q` for the cache.  nothing happens if caching is
+// disabled or memory is short; another thread may have inserted the same
+// query meanwhile, which only costs an extra entry until it is evicted.
+static void jts_query_cache_insert(const TSLanguage *language, uint64_t hash,
+                                   const char *source, uint32_t source_len,
+                                   JTSQuery *q) {
+  JTSQueryCacheEntry *e =
+    (JTSQueryCacheEntry *)malloc(sizeof(JTSQueryCacheEntry));
+  char *copy = (char *)malloc((size_t)source_len + 1);
+  if ((NULL == e) || (NULL == copy)) {
+    free(e);
+    free(copy);
+    return;
+  }
+  memcpy(copy, source, source_len);
+  e->language = language;
+  e->hash = hash;
+  e->source = copy;
+  e->source_len = source_len;
+  e->query = q;
+
+  JTSQuery *evicted[2];
+  size_t n_evicted = 0;
+
+  jts_mutex_lock(&jts_query_cache_lock);
+  if (0 == jts_query_cache_capacity) {
+    jts_mutex_unlock(&jts_query_cache_lock);
+    free(copy);
+    free(e);
+    return;
+  }
+  jts_atomic_inc(&q->refcount);
+  jts_query_cache_push_front(e);
+  jts_query_cache_count++;
+  jts_query_cache_bytes += source_len;
+  jts_query_cache_trim(evicted, &n_evicted);
+  jts_mutex_unlock(&jts_query_cache_lock);
+
+  for (size_t i = 0; i < n_evicted; i++) {
+    jts_query_release(evicted[i]);
+  }
+}
+
+/**
+ * Set the maximum number of cached queries (0 disables caching) and
+ * evict entries beyond it.  Returns the previous capacity.
+ */
+static Janet cfun_query_cache_set_capacity(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  size_t capacity = (size_t)janet_getnat(argv, 0);
+
+  JTSQuery **evicted = NULL;
+  size_t n_evicted = 0;
+  int failed = 0;
+
+  jts_mutex_lock(&jts_query_cache_lock);
+  size_t previous = jts_query_cache_capacity;
+  if (jts_query_cache_count > capacity) {
+    evicted = (JTSQuery **)malloc(sizeof(JTSQuery *) *
+                                  (jts_query_cache_count - capacity));
+    failed = (NULL == evicted);
+  }
+  if (!failed) {
+    jts_query_cache_capacity = capacity;
+    jts_query_cache_trim(evicted, &n_evicted);
+  }
+  jts_mutex_unlock(&jts_query_cache_lock);
+
+  if (failed) {
+    janet_panic("failed to allocate while evicting queries");
+  }
+
+  for (size_t i = 0; i < n_evicted; i++) {
+    jts_query_release(evicted[i]);
+  }
+  free(evicted);
+
+  return janet_wrap_number((double)previous);
+}
+
+static Janet cfun_query_cache_stats(int32_t argc, Janet *argv) {
+  (void)argv;
+  janet_fixarity(argc, 0);
+
+  jts_mutex_lock(&jts_query_cache_lock);
+  double entries = (double)jts_query_cache_count;
+  double capacity = (double)jts_query_cache_capacity;
+  double bytes = (double)jts_query_cache_bytes;
+  double hits = (double)jts_query_cache_hits;
+  double misses = (double)jts_query_cache_misses;
+  jts_mutex_unlock(&jts_query_cache_lock);
+
+  JanetKV *st = janet_struct_begin(5);
+  janet_struct_put(st, janet_ckeywordv("entries"), janet_wrap_number(entries));
+  janet_struct_put(st, janet_ckeywordv("capacity"),
+                   janet_wrap_number(capacity));
+  janet_struct_put(st, janet_ckeywordv("source-bytes"),
+                   janet_wrap_number(bytes));
+  janet_struct_put(st, janet_ckeywordv("hits"), janet_wrap_number(hits));
+  janet_struct_put(st, janet_ckeywordv("misses"), janet_wrap_number(misses));
+
+  return janet_wrap_struct(janet_struct_end(st));
 }
 
+//////// end query cache ////////
+
 /**
  * Create a new query from a string containing one or more S-expression
  * patterns. The query is associated with a particular language, and can
@@ -1497,6 +6464,17 @@ static Janet cfun_query_new(int32_t argc, Janet *argv) {
   // XXX: is this off by one?
   uint32_t src_len = (uint32_t)strlen(src);
 
+  JTSQuery **q_pp =
+    (JTSQuery **)janet_abstract(&jts_query_type, sizeof(JTSQuery *));
+  *q_pp = NULL;
+
+  uint64_t hash = jts_hash_bytes(src, src_len);
+
+  *q_pp = jts_query_cache_lookup(*lang_pp, hash, src, src_len);
+  if (NULL != *q_pp) {
+    return janet_wrap_abstract(q_pp);
+  }
+
   uint32_t error_offset = 0;
   TSQueryError error_type = TSQueryErrorNone;
 
@@ -1533,10 +6511,23 @@ static Janet cfun_query_new(int32_t argc, Janet *argv) {
     return janet_wrap_tuple(janet_tuple_end(tup));
   }
 
-  TSQuery **q_pp =
-    (TSQuery **)janet_abstract(&jts_query_type, sizeof(TSQuery *));
+  JTSQuery *q_p = (JTSQuery *)calloc(1, sizeof(JTSQuery));
+  if (NULL == q_p) {
+    ts_query_delete(query_p);
+    janet_panic("failed to allocate query");
+  }
+  q_p->query = query_p;
+  q_p->refcount = 1;
+
+  char err[256];
+  if (0 != jts_query_compile_predicates(q_p, err, sizeof(err))) {
+    jts_query_free(q_p);
+    janet_panic(err);
+  }
+
+  jts_query_cache_insert(*lang_pp, hash, src, src_len, q_p);
 
-  *q_pp = query_p;
+  *q_pp = q_p;
 
   return janet_wrap_abstract(q_pp);
 }
@@ -1549,14 +6540,14 @@ static Janet cfun_query_new(int32_t argc, Janet *argv) {
 static Janet cfun_query_capture_name_for_id(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 2);
 
-  TSQuery **query_pp = jts_get_query(argv, 0);
+  JTSQuery *query_p = jts_get_query(argv, 0);
   // XXX; error checking?
 
   uint32_t id = (uint32_t)janet_getinteger(argv, 1);
 
   uint32_t length = 0;
 
-  const char *name = ts_query_capture_name_for_id(*query_pp, id, &length);
+  const char *name = ts_query_capture_name_for_id(query_p->query, id, &length);
   if (NULL == name) {
     return janet_wrap_nil();
   }
@@ -1569,13 +6560,71 @@ static Janet cfun_query_capture_name_for_id(int32_t argc, Janet *argv) {
   return janet_wrap_tuple(janet_tuple_end(tup));
 }
 
+/**
+ * Get all of the predicates for the given pattern in the query.
+ *
+ * Each predicate is a tuple of the predicate name followed by its
+ * arguments: strings as strings and captures as `[:capture id]`.
+ * Text predicates are also evaluated natively by query cursors, except
+ * #match? where regular expressions are unavailable (e.g. on windows).
+ * If `unevaluated` is truthy, only the predicates query cursors leave
+ * to the caller are returned.
+ */
+static Janet cfun_query_predicates_for_pattern(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 3);
+
+  JTSQuery *query_p = jts_get_query(argv, 0);
+
+  int32_t pattern_index = janet_getnat(argv, 1);
+  if ((uint32_t)pattern_index >= ts_query_pattern_count(query_p->query)) {
+    janet_panicf("pattern index %d out of range", pattern_index);
+  }
+
+  uint32_t n_steps = 0;
+  const TSQueryPredicateStep *steps =
+    ts_query_predicates_for_pattern(query_p->query,
+                                    (uint32_t)pattern_index, &n_steps);
+
+  int unevaluated = (argc > 2) && janet_truthy(argv[2]);
+
+  JanetArray *preds = janet_array(0);
+  JanetArray *pred = janet_array(0);
+  for (uint32_t i = 0; i < n_steps; i++) {
+    if (TSQueryPredicateStepTypeDone == steps[i].type) {
+      int negate = 0;
+      int skip = unevaluated && (pred->count > 0) &&
+        janet_checktype(pred->data[0], JANET_STRING) &&
+        (jts_predicate_kind((const char *)janet_unwrap_string(pred->data[0]),
+                            &negate) >= 0);
+      if (!skip) {
+        janet_array_push(preds,
+                         janet_wrap_tuple(janet_tuple_n(pred->data,
+                                                        pred->count)));
+      }
+      pred->count = 0;
+    } else if (TSQueryPredicateStepTypeCapture == steps[i].type) {
+      Janet *tup = janet_tuple_begin(2);
+      tup[0] = janet_ckeywordv("capture");
+      tup[1] = janet_wrap_integer((int32_t)steps[i].value_id);
+      janet_array_push(pred, janet_wrap_tuple(janet_tuple_end(tup)));
+    } else {
+      uint32_t len = 0;
+      const char *str = jts_query_string(query_p, steps[i].value_id, &len);
+      janet_array_push(pred,
+                       janet_stringv((const uint8_t *)str, (int32_t)len));
+    }
+  }
+
+  return janet_wrap_array(preds);
+}
+
 static const JanetMethod query_methods[] = {
   //{"delete", cfun_query_delete},
   //{"pattern-count", cfun_query_pattern_count},
   //{"capture-count", cfun_query_capture_count},
   //{"string-count", cfun_query_string_count},
   //{"start-byte-for-pattern", cfun_query_start_byte_for_pattern},
-  //{"predicates-for-pattern", cfun_query_predicates_for_pattern},
+  {"predicates-for-pattern", cfun_query_predicates_for_pattern},
   //{"is-pattern-rooted", cfun_query_is_pattern_rooted},
   //{"is-pattern-guaranteed-at-step", cfun_query_is_pattern_guaranteed_at_step},
   {"capture-name-for-id", cfun_query_capture_name_for_id},
@@ -1589,87 +6638,356 @@ static const JanetMethod query_methods[] = {
 static int jts_query_gc(void *p, size_t size) {
   (void) size;
 
-  TSQuery **query_pp = (TSQuery **)p;
-  if (*query_pp != NULL) {
-    ts_query_delete(*query_pp);
-    *query_pp = NULL;
+  JTSQuery **query_pp = (JTSQuery **)p;
+  if (*query_pp != NULL) {
+    jts_query_release(*query_pp);
+    *query_pp = NULL;
+  }
+
+  return 0;
+}
+
+static int jts_query_get(void *p, Janet key, Janet *out) {
+  (void) p;
+
+  if (!janet_checktype(key, JANET_KEYWORD)) {
+    return 0;
+  }
+
+  return janet_getmethod(janet_unwrap_keyword(key), query_methods, out);
+}
+
+////////
+
+static JTSQueryCursor *jts_get_query_cursor(const Janet *argv, uint32_t n) {
+  return (JTSQueryCursor *)janet_getabstract(argv, (int32_t)n, &jts_query_cursor_type);
+}
+
+/**
+ * Create a new cursor for executing a given query.
+ *
+ * The cursor stores the state that is needed to iteratively search
+ * for matches. To use the query cursor, first call `ts_query_cursor_exec`
+ * to start running a given query on a given syntax node. Then, there are
+ * two options for consuming the results of the query:
+ * 1. Repeatedly call `ts_query_cursor_next_match` to iterate over all of the
+ *    *matches* in the order that they were found. Each match contains the
+ *    index of the pattern that matched, and an array of captures. Because
+ *    multiple patterns can match the same set of nodes, one match may contain
+ *    captures that appear *before* some of the captures from a previous match.
+ * 2. Repeatedly call `ts_query_cursor_next_capture` to iterate over all of the
+ *    individual *captures* in the order that they appear. This is useful if
+ *    don't care about which pattern matched, and just want a single ordered
+ *    sequence of captures.
+ *
+ * If you don't care about consuming all of the results, you can stop calling
+ * `ts_query_cursor_next_match` or `ts_query_cursor_next_capture` at any point.
+ *  You can then start executing another query on another node by calling
+ *  `ts_query_cursor_exec` again.
+ */
+static Janet cfun_query_cursor_new(int32_t argc, Janet *argv) {
+  (void)argv;
+  janet_fixarity(argc, 0);
+
+  JTSQueryCursor *qc_p =
+    (JTSQueryCursor *)janet_abstract(&jts_query_cursor_type,
+                                     sizeof(JTSQueryCursor));
+  memset(qc_p, 0, sizeof(JTSQueryCursor));
+  qc_p->query = janet_wrap_nil();
+  qc_p->tree = janet_wrap_nil();
+  qc_p->source = janet_wrap_nil();
+  qc_p->cursor = ts_query_cursor_new();
+  if (NULL == qc_p->cursor) {
+    return janet_wrap_nil();
+  }
+
+  return janet_wrap_abstract(qc_p);
+}
+
+/**
+ * Start running a given query on a given node.
+ *
+ * If the query has text predicates (#eq?, #match?, #any-of? and their
+ * `not-` forms), the source the node was parsed from (string, buffer,
+ * or file mapping) must be given as well.  Matches failing a predicate
+ * are then dropped before they are returned.  For a tree parsed from a
+ * slice via parse-bytes, also give the slice's byte offset within the
+ * source.
+ */
+static Janet cfun_query_cursor_exec(int32_t argc, Janet *argv) {
+  janet_arity(argc, 3, 5);
+
+  JTSQueryCursor *qc_p = jts_get_query_cursor(argv, 0);
+  // XXX: error checking?
+
+  JTSQuery *query_p = jts_get_query(argv, 1);
+  // XXX; error checking?
+
+  JTSNode *node_p = jts_get_node(argv, 2);
+  if (ts_node_is_null(node_p->node)) {
+    return janet_wrap_nil();
+  }
+
+  Janet source = janet_wrap_nil();
+  if ((argc > 3) && !janet_checktype(argv[3], JANET_NIL)) {
+    (void)jts_get_source(argv, 3);
+    source = argv[3];
+  } else if (query_p->predicate_count > 0) {
+    janet_panic("source required for query with text predicates");
+  }
+
+  int32_t offset = janet_optnat(argv, argc, 4, 0);
+  if (!janet_checktype(source, JANET_NIL)) {
+    (void)jts_source_from(jts_get_source(argv, 3), offset);
+  }
+
+  qc_p->query = argv[1];
+  qc_p->tree = node_p->tree;
+  qc_p->source = source;
+  qc_p->source_offset = offset;
+  qc_p->matches = 0;
+  qc_p->captures = 0;
+  qc_p->has_last_match = 0;
+
+  // XXX: no failure indication
+  ts_query_cursor_exec(qc_p->cursor, query_p->query, node_p->node);
+
+  return janet_wrap_nil();
+}
+
+static int jts_capture_text(JanetByteView source, TSNode node,
+                            const uint8_t **text, uint32_t *len) {
+  uint32_t start = ts_node_start_byte(node);
+  uint32_t end = ts_node_end_byte(node);
+  if ((end < start) || (end > (uint32_t)source.len)) {
+    return 0;
+  }
+
+  *text = source.bytes + start;
+  *len = end - start;
+
+  return 1;
+}
+
+// returns 1 if text equals one of the predicate's strings, else 0
+static int jts_text_in_values(const JTSQuery *q, const JTSPredicate *pred,
+                              const uint8_t *text, uint32_t len) {
+  for (uint32_t i = 0; i < pred->value_count; i++) {
+    uint32_t value_len = 0;
+    const char *value = jts_query_string(q, pred->value_ids[i], &value_len);
+    if ((len == value_len) && (0 == memcmp(text, value, len))) {
+      return 1;
+    }
   }
 
   return 0;
 }
 
-static int jts_query_get(void *p, Janet key, Janet *out) {
-  (void) p;
+// returns 1 if the predicate holds, 0 if not, 2 if it holds regardless
+// of negation (a capture it compares against is absent), -1 if out of
+// memory
+static int jts_predicate_holds(JTSScratch *scratch, const JTSQuery *q,
+                               const JTSPredicate *pred,
+                               const TSQueryMatch *match,
+                               JanetByteView source,
+                               const uint8_t *text, uint32_t len) {
+  switch (pred->kind) {
+    case JTS_PRED_EQ:
+      if (pred->other_capture_id >= 0) {
+        for (uint16_t i = 0; i < match->capture_count; i++) {
+          if ((int64_t)match->captures[i].index == pred->other_capture_id) {
+            const uint8_t *other = NULL;
+            uint32_t other_len = 0;
+            if (!jts_capture_text(source, match->captures[i].node,
+                                  &other, &other_len)) {
+              return 0;
+            }
+            return (len == other_len) && (0 == memcmp(text, other, len));
+          }
+        }
+        // the other capture is absent, e.g. optional
+        return 2;
+      }
+      return jts_text_in_values(q, pred, text, len);
+    case JTS_PRED_ANY_OF:
+      return jts_text_in_values(q, pred, text, len);
+#if JTS_HAVE_REGEX
+    case JTS_PRED_MATCH:
+      if (scratch->capacity < (size_t)len + 1) {
+        char *grown = (char *)realloc(scratch->data, (size_t)len + 1);
+        if (NULL == grown) {
+          return -1;
+        }
+        scratch->data = grown;
+        scratch->capacity = (size_t)len + 1;
+      }
+      memcpy(scratch->data, text, len);
+      scratch->data[len] = '\0';
+      return 0 == regexec(&pred->regex, scratch->data, 0, NULL, 0);
+#endif
+    default:
+      return 1;
+  }
+}
 
-  if (!janet_checktype(key, JANET_KEYWORD)) {
-    return 0;
+/**
+ * Evaluate the text predicates of the match's pattern.  Each node of a
+ * predicate's capture must satisfy it; a predicate on a capture that is
+ * not in the match holds.
+ *
+ * Returns 1 if the match passes, 0 if not, -1 if out of memory.  Safe
+ * to call from worker threads.
+ */
+static int jts_match_passes_in(const JTSQuery *q, const TSQueryMatch *match,
+                               JanetByteView source, JTSScratch *scratch) {
+  uint32_t start = q->pattern_starts[match->pattern_index];
+  uint32_t end = q->pattern_starts[match->pattern_index + 1];
+
+  for (uint32_t p = start; p < end; p++) {
+    const JTSPredicate *pred = &q->predicates[p];
+    for (uint16_t i = 0; i < match->capture_count; i++) {
+      if (match->captures[i].index != pred->capture_id) {
+        continue;
+      }
+      const uint8_t *text = NULL;
+      uint32_t len = 0;
+      if (!jts_capture_text(source, match->captures[i].node, &text, &len)) {
+        return 0;
+      }
+      int holds =
+        jts_predicate_holds(scratch, q, pred, match, source, text, len);
+      if (holds < 0) {
+        return -1;
+      }
+      if (2 == holds) {
+        continue;
+      }
+      if (holds == pred->negate) {
+        return 0;
+      }
+    }
   }
 
-  return janet_getmethod(janet_unwrap_keyword(key), query_methods, out);
+  return 1;
 }
 
-////////
+static int jts_match_passes(JTSQueryCursor *qc_p, const TSQueryMatch *match) {
+  const JTSQuery *q = *(JTSQuery **)janet_unwrap_abstract(qc_p->query);
+  if (q->pattern_starts[match->pattern_index] ==
+      q->pattern_starts[match->pattern_index + 1]) {
+    return 1;
+  }
+
+  // a buffer source may have shrunk since exec, leaving no text
+  JanetByteView source = jts_get_source(&qc_p->source, 0);
+  if (qc_p->source_offset > source.len) {
+    source.len = 0;
+  } else {
+    source = jts_source_from(source, qc_p->source_offset);
+  }
+
+  int passes = jts_match_passes_in(q, match, source, &qc_p->scratch);
+  if (passes < 0) {
+    janet_panic("failed to allocate predicate text");
+  }
 
-static TSQueryCursor **jts_get_query_cursor(const Janet *argv, uint32_t n) {
-  return (TSQueryCursor **)janet_getabstract(argv, (int32_t)n, &jts_query_cursor_type);
+  return passes;
 }
 
 /**
- * Create a new cursor for executing a given query.
+ * Like `ts_query_cursor_next_capture`, skipping captures of matches that
+ * fail their predicates.  Such matches are removed so their remaining
+ * captures are skipped cheaply.
  *
- * The cursor stores the state that is needed to iteratively search
- * for matches. To use the query cursor, first call `ts_query_cursor_exec`
- * to start running a given query on a given syntax node. Then, there are
- * two options for consuming the results of the query:
- * 1. Repeatedly call `ts_query_cursor_next_match` to iterate over all of the
- *    *matches* in the order that they were found. Each match contains the
- *    index of the pattern that matched, and an array of captures. Because
- *    multiple patterns can match the same set of nodes, one match may contain
- *    captures that appear *before* some of the captures from a previous match.
- * 2. Repeatedly call `ts_query_cursor_next_capture` to iterate over all of the
- *    individual *captures* in the order that they appear. This is useful if
- *    don't care about which pattern matched, and just want a single ordered
- *    sequence of captures.
+ * Each passing match is counted once, with its first capture.  A match's
+ * captures come in order, but may be interleaved with those of other
+ * matches, so a change of match id alone could count a match twice.
+ */
+static bool jts_next_capture(JTSQueryCursor *qc_p, TSQueryMatch *match,
+                             uint32_t *capture_index) {
+  while (ts_query_cursor_next_capture(qc_p->cursor, match, capture_index)) {
+    if (!qc_p->has_last_match || (qc_p->last_match_id != match->id)) {
+      qc_p->has_last_match = 1;
+      qc_p->last_match_id = match->id;
+      qc_p->last_match_passed = jts_match_passes(qc_p, match);
+    }
+    if (qc_p->last_match_passed) {
+      if (0 == *capture_index) {
+        qc_p->matches++;
+      }
+      return true;
+    }
+    ts_query_cursor_remove_match(qc_p->cursor, match->id);
+  }
+
+  return false;
+}
+
+// optional u32 argument where nil (or absence) means `dflt`
+static uint32_t jts_opt_u32(const Janet *argv, int32_t argc, int32_t n,
+                            uint32_t dflt) {
+  if ((n >= argc) || janet_checktype(argv[n], JANET_NIL)) {
+    return dflt;
+  }
+
+  int64_t x = janet_getinteger64(argv, n);
+  if ((x < 0) || (x > UINT32_MAX)) {
+    janet_panicf("expected integer in [0, 4294967295], got %v", argv[n]);
+  }
+
+  return (uint32_t)x;
+}
+
+/**
+ * Set the range of bytes or (row, column) positions in which the query
+ * will be executed.
  *
- * If you don't care about consuming all of the results, you can stop calling
- * `ts_query_cursor_next_match` or `ts_query_cursor_next_capture` at any point.
- *  You can then start executing another query on another node by calling
- *  `ts_query_cursor_exec` again.
+ * The range applies to subsequent calls to `exec`.  An end of nil means
+ * the end of the tree.
  */
-static Janet cfun_query_cursor_new(int32_t argc, Janet *argv) {
-  (void)argv;
-  janet_fixarity(argc, 0);
+static Janet cfun_query_cursor_set_byte_range(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 3);
 
-  TSQueryCursor **qc_pp =
-    (TSQueryCursor **)janet_abstract(&jts_query_cursor_type,
-                                     sizeof(TSQueryCursor *));
-  *qc_pp = ts_query_cursor_new();
-  if (NULL == *qc_pp) {
-    return janet_wrap_nil();
+  JTSQueryCursor *qc_p = jts_get_query_cursor(argv, 0);
+
+  uint32_t start_byte = jts_opt_u32(argv, argc, 1, 0);
+  uint32_t end_byte = jts_opt_u32(argv, argc, 2, UINT32_MAX);
+  if (start_byte > end_byte) {
+    janet_panicf("start byte %v is after end byte %v", argv[1], argv[2]);
   }
 
-  return janet_wrap_abstract(qc_pp);
+  ts_query_cursor_set_byte_range(qc_p->cursor, start_byte, end_byte);
+
+  return janet_wrap_nil();
 }
 
 /**
- * Start running a given query on a given node.
+ * Point counterpart of `set-byte-range`: start row and column, then end
+ * row and column.  An end row of nil means the end of the tree.
  */
-static Janet cfun_query_cursor_exec(int32_t argc, Janet *argv) {
-  janet_fixarity(argc, 3);
+static Janet cfun_query_cursor_set_point_range(int32_t argc, Janet *argv) {
+  janet_arity(argc, 3, 5);
 
-  TSQueryCursor **qc_pp = jts_get_query_cursor(argv, 0);
-  // XXX: error checking?
+  JTSQueryCursor *qc_p = jts_get_query_cursor(argv, 0);
 
-  TSQuery **query_pp = jts_get_query(argv, 1);
-  // XXX; error checking?
+  TSPoint start_point = {
+    jts_opt_u32(argv, argc, 1, 0),
+    jts_opt_u32(argv, argc, 2, 0)
+  };
 
-  TSNode node = *jts_get_node(argv, 2);
-  if (ts_node_is_null(node)) {
-    return janet_wrap_nil();
+  TSPoint end_point = {UINT32_MAX, UINT32_MAX};
+  if ((argc > 3) && !janet_checktype(argv[3], JANET_NIL)) {
+    end_point.row = jts_opt_u32(argv, argc, 3, UINT32_MAX);
+    end_point.column = jts_opt_u32(argv, argc, 4, UINT32_MAX);
   }
 
-  // XXX: no failure indication
-  ts_query_cursor_exec(*qc_pp, *query_pp, node);
+  if ((start_point.row > end_point.row) ||
+      ((start_point.row == end_point.row) &&
+       (start_point.column > end_point.column))) {
+    janet_panic("start point is after end point");
+  }
+
+  ts_query_cursor_set_point_range(qc_p->cursor, start_point, end_point);
 
   return janet_wrap_nil();
 }
@@ -1683,14 +7001,19 @@ static Janet cfun_query_cursor_exec(int32_t argc, Janet *argv) {
 static Janet cfun_query_cursor_next_match(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
 
-  TSQueryCursor **qc_pp = jts_get_query_cursor(argv, 0);
+  JTSQueryCursor *qc_p = jts_get_query_cursor(argv, 0);
   // XXX: error checking?
 
   TSQueryMatch match;
 
-  if (!ts_query_cursor_next_match(*qc_pp, &match)) {
-    return janet_wrap_nil();
-  }
+  do {
+    if (!ts_query_cursor_next_match(qc_p->cursor, &match)) {
+      return janet_wrap_nil();
+    }
+  } while (!jts_match_passes(qc_p, &match));
+
+  qc_p->matches++;
+  qc_p->captures += match.capture_count;
 
   // sample return value - 3-tuple: id, pattern_index, captures
   //
@@ -1714,12 +7037,7 @@ static Janet cfun_query_cursor_next_match(int32_t argc, Janet *argv) {
     Janet *itup = janet_tuple_begin(2);
 
     itup[0] = janet_wrap_integer(index);
-
-    TSNode *node_p =
-      (TSNode *)janet_abstract(&jts_node_type, sizeof(TSNode));
-
-    *node_p = node;
-    itup[1] = janet_wrap_abstract(node_p);
+    itup[1] = jts_wrap_node(node, qc_p->tree);
 
     ctup[i] = janet_wrap_tuple(janet_tuple_end(itup));
   }
@@ -1729,28 +7047,216 @@ static Janet cfun_query_cursor_next_match(int32_t argc, Janet *argv) {
   return janet_wrap_tuple(janet_tuple_end(tup));
 }
 
+/**
+ * Advance to the next capture of the currently running query.
+ *
+ * If there is a capture, write its match to `*match` and its index within
+ * the match's capture list to `*capture_index`. Otherwise, return `false`.
+ */
+static Janet cfun_query_cursor_next_capture(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSQueryCursor *qc_p = jts_get_query_cursor(argv, 0);
+
+  TSQueryMatch match;
+  uint32_t capture_index = 0;
+
+  if (!jts_next_capture(qc_p, &match, &capture_index)) {
+    return janet_wrap_nil();
+  }
+
+  qc_p->captures++;
+
+  // sample return value - 4-tuple: id, pattern_index, capture id, node
+  //
+  // (0                     <- id
+  //  0                     <- pattern_index
+  //  1                     <- capture id, as for capture-name-for-id
+  //  <tree-sitter/node ...>)
+  TSQueryCapture capture = match.captures[capture_index];
+
+  Janet *tup = janet_tuple_begin(4);
+
+  tup[0] = janet_wrap_integer(match.id);
+  tup[1] = janet_wrap_integer(match.pattern_index);
+  tup[2] = janet_wrap_integer(capture.index);
+
+  tup[3] = jts_wrap_node(capture.node, qc_p->tree);
+
+  return janet_wrap_tuple(janet_tuple_end(tup));
+}
+
+/**
+ * Append the next captures of the currently running query to a buffer
+ * as packed records of little-endian u32 values:
+ *
+ *   capture id, pattern index, start byte, end byte
+ *
+ * followed, if `with-points` is truthy, by start row, start column, end
+ * row, and end column.  At most `max` (default: all remaining) records
+ * are written.  Returns the number of records written, 0 once the query
+ * is exhausted.
+ */
+static Janet cfun_query_cursor_captures_into(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 4);
+
+  JTSQueryCursor *qc_p = jts_get_query_cursor(argv, 0);
+
+  JanetBuffer *buf = janet_getbuffer(argv, 1);
+
+  int32_t max = INT32_MAX;
+  if ((argc > 2) && !janet_checktype(argv[2], JANET_NIL)) {
+    max = janet_getnat(argv, 2);
+  }
+
+  int with_points = (argc > 3) && janet_truthy(argv[3]);
+  int32_t rec_size = (with_points ? 8 : 4) * (int32_t)sizeof(uint32_t);
+
+  TSQueryMatch match;
+  uint32_t capture_index = 0;
+
+  int32_t count = 0;
+  while ((count < max) &&
+         jts_next_capture(qc_p, &match, &capture_index)) {
+    TSQueryCapture capture = match.captures[capture_index];
+
+    janet_buffer_extra(buf, rec_size);
+    janet_buffer_push_u32(buf, capture.index);
+    janet_buffer_push_u32(buf, match.pattern_index);
+    janet_buffer_push_u32(buf, ts_node_start_byte(capture.node));
+    janet_buffer_push_u32(buf, ts_node_end_byte(capture.node));
+    if (with_points) {
+      TSPoint start = ts_node_start_point(capture.node);
+      TSPoint end = ts_node_end_point(capture.node);
+      janet_buffer_push_u32(buf, start.row);
+      janet_buffer_push_u32(buf, start.column);
+      janet_buffer_push_u32(buf, end.row);
+      janet_buffer_push_u32(buf, end.column);
+    }
+    count++;
+  }
+
+  qc_p->captures += (uint32_t)count;
+
+  return janet_wrap_integer(count);
+}
+
+/**
+ * Check whether the maximum number of in-progress matches allowed by
+ * this query cursor was exceeded.
+ *
+ * Query cursors have an optional maximum capacity for storing lists of
+ * in-progress captures. If this capacity is exceeded, then the
+ * earliest-starting match will silently be dropped to make room for
+ * further matches. This maximum capacity is optional — by default,
+ * query cursors allow any number of pending matches, dynamically
+ * allocating new space for them as needed as the query is executed.
+ */
+static Janet cfun_query_cursor_did_exceed_match_limit(int32_t argc,
+                                                      Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSQueryCursor *qc_p = jts_get_query_cursor(argv, 0);
+
+  return janet_wrap_boolean(
+           ts_query_cursor_did_exceed_match_limit(qc_p->cursor));
+}
+
+static Janet cfun_query_cursor_match_limit(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSQueryCursor *qc_p = jts_get_query_cursor(argv, 0);
+
+  uint32_t limit = ts_query_cursor_match_limit(qc_p->cursor);
+  // the default of no limit is UINT32_MAX
+  if (UINT32_MAX == limit) {
+    return janet_wrap_nil();
+  }
+
+  return janet_wrap_number((double)limit);
+}
+
+/**
+ * Set the maximum number of in-progress matches.  nil removes the
+ * limit.
+ */
+static Janet cfun_query_cursor_set_match_limit(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+
+  JTSQueryCursor *qc_p = jts_get_query_cursor(argv, 0);
+
+  uint32_t limit = jts_opt_u32(argv, argc, 1, UINT32_MAX);
+  if (0 == limit) {
+    janet_panic("match limit must be positive");
+  }
+
+  ts_query_cursor_set_match_limit(qc_p->cursor, limit);
+
+  return janet_wrap_nil();
+}
+
+/**
+ * Get counters for the current (or last) exec as a struct:
+ * `:matches` and `:captures` produced so far, and
+ * `:exceeded-match-limit`, true if in-progress matches were dropped
+ * because of the match limit.
+ */
+static Janet cfun_query_cursor_stats(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+
+  JTSQueryCursor *qc_p = jts_get_query_cursor(argv, 0);
+
+  JanetKV *st = janet_struct_begin(3);
+  janet_struct_put(st, janet_ckeywordv("matches"),
+                   janet_wrap_number((double)qc_p->matches));
+  janet_struct_put(st, janet_ckeywordv("captures"),
+                   janet_wrap_number((double)qc_p->captures));
+  janet_struct_put(st, janet_ckeywordv("exceeded-match-limit"),
+                   janet_wrap_boolean(
+                     ts_query_cursor_did_exceed_match_limit(qc_p->cursor)));
+
+  return janet_wrap_struct(janet_struct_end(st));
+}
+
 static const JanetMethod query_cursor_methods[] = {
   //{"delete", cfun_query_cursor_delete},
   {"exec", cfun_query_cursor_exec},
-  //{"did-exceed-match-limit", cfun_query_cursor_did_exceed_match_limit},
-  //{"match-limit", cfun_query_cursor_match_limit},
-  //{"set-match-limit", cfun_query_cursor_set_match_limit},
-  //{"set-byte-range", cfun_query_cursor_set_byte_range},
-  //{"set-point-range", cfun_query_cursor_set_point_range},
+  {"did-exceed-match-limit", cfun_query_cursor_did_exceed_match_limit},
+  {"match-limit", cfun_query_cursor_match_limit},
+  {"set-match-limit", cfun_query_cursor_set_match_limit},
+  {"set-byte-range", cfun_query_cursor_set_byte_range},
+  {"set-point-range", cfun_query_cursor_set_point_range},
   {"next-match", cfun_query_cursor_next_match},
   //{"remove-match", cfun_query_cursor_remove_match},
-  //{"next-capture", cfun_query_cursor_next_capture},
+  {"next-capture", cfun_query_cursor_next_capture},
+  // custom
+  {"captures-into", cfun_query_cursor_captures_into},
+  {"stats", cfun_query_cursor_stats},
   {NULL, NULL}
 };
 
 static int jts_query_cursor_gc(void *p, size_t size) {
   (void) size;
 
-  TSQueryCursor **qc_pp = (TSQueryCursor **)p;
-  if (*qc_pp != NULL) {
-    ts_query_cursor_delete(*qc_pp);
-    *qc_pp = NULL;
+  JTSQueryCursor *qc_p = (JTSQueryCursor *)p;
+  if (qc_p->cursor != NULL) {
+    ts_query_cursor_delete(qc_p->cursor);
+    qc_p->cursor = NULL;
   }
+  free(qc_p->scratch.data);
+  qc_p->scratch.data = NULL;
+  qc_p->scratch.capacity = 0;
+
+  return 0;
+}
+
+static int jts_query_cursor_gcmark(void *p, size_t size) {
+  (void) size;
+
+  JTSQueryCursor *qc_p = (JTSQueryCursor *)p;
+  janet_mark(qc_p->query);
+  janet_mark(qc_p->tree);
+  janet_mark(qc_p->source);
 
   return 0;
 }
@@ -1769,6 +7275,253 @@ static int jts_query_cursor_get(void *p, Janet key, Janet *out) {
 
 ////////
 
+// packed capture records built by worker threads, outside janet's heap
+
+typedef struct {
+  uint8_t *data;
+  size_t count;
+  size_t capacity;
+} JTSBytes;
+
+static int jts_bytes_push_u32(JTSBytes *b, uint32_t x) {
+  if (b->count + 4 > b->capacity) {
+    size_t capacity = (0 == b->capacity) ? 256 : 2 * b->capacity;
+    uint8_t *grown = (uint8_t *)realloc(b->data, capacity);
+    if (NULL == grown) {
+      return -1;
+    }
+    b->data = grown;
+    b->capacity = capacity;
+  }
+
+  // little-endian, like janet_buffer_push_u32
+  b->data[b->count++] = (uint8_t)(x & 0xFF);
+  b->data[b->count++] = (uint8_t)((x >> 8) & 0xFF);
+  b->data[b->count++] = (uint8_t)((x >> 16) & 0xFF);
+  b->data[b->count++] = (uint8_t)((x >> 24) & 0xFF);
+
+  return 0;
+}
+
+typedef struct {
+  const JTSQuery *query;
+  int with_points;
+  int32_t count;
+  TSTree **trees;
+  JanetByteView *sources;
+  JTSBytes *results;
+  // set for items that ran out of memory
+  uint8_t *failed;
+  int32_t next;
+} JTSQueryBatch;
+
+static int jts_query_batch_run(TSQueryCursor *cursor, JTSQueryBatch *batch,
+                               int32_t i, JTSScratch *scratch) {
+  JTSBytes *out = &batch->results[i];
+
+  ts_query_cursor_exec(cursor, batch->query->query,
+                       ts_tree_root_node(batch->trees[i]));
+
+  TSQueryMatch match;
+  uint32_t capture_index = 0;
+  int has_last = 0;
+  uint32_t last_id = 0;
+  int last_passed = 0;
+  while (ts_query_cursor_next_capture(cursor, &match, &capture_index)) {
+    if (!has_last || (last_id != match.id)) {
+      has_last = 1;
+      last_id = match.id;
+      last_passed =
+        jts_match_passes_in(batch->query, &match, batch->sources[i], scratch);
+      if (last_passed < 0) {
+        return -1;
+      }
+    }
+    if (!last_passed) {
+      ts_query_cursor_remove_match(cursor, match.id);
+      continue;
+    }
+
+    TSQueryCapture capture = match.captures[capture_index];
+    if ((0 != jts_bytes_push_u32(out, capture.index)) ||
+        (0 != jts_bytes_push_u32(out, match.pattern_index)) ||
+        (0 != jts_bytes_push_u32(out, ts_node_start_byte(capture.node))) ||
+        (0 != jts_bytes_push_u32(out, ts_node_end_byte(capture.node)))) {
+      return -1;
+    }
+    if (batch->with_points) {
+      TSPoint start = ts_node_start_point(capture.node);
+      TSPoint end = ts_node_end_point(capture.node);
+      if ((0 != jts_bytes_push_u32(out, start.row)) ||
+          (0 != jts_bytes_push_u32(out, start.column)) ||
+          (0 != jts_bytes_push_u32(out, end.row)) ||
+          (0 != jts_bytes_push_u32(out, end.column))) {
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+static JTS_THREAD_FN(jts_query_batch_worker, arg) {
+  JTSQueryBatch *batch = (JTSQueryBatch *)arg;
+
+  TSQueryCursor *cursor = ts_query_cursor_new();
+  JTSScratch scratch = {NULL, 0};
+
+  while (1) {
+    int32_t i = (int32_t)jts_atomic_inc(&batch->next) - 1;
+    if (i >= batch->count) {
+      break;
+    }
+
+    if ((NULL == cursor) ||
+        (0 != jts_query_batch_run(cursor, batch, i, &scratch))) {
+      batch->failed[i] = 1;
+    }
+  }
+
+  free(scratch.data);
+  if (NULL != cursor) {
+    ts_query_cursor_delete(cursor);
+  }
+
+  return JTS_THREAD_RESULT;
+}
+
+static void jts_query_batch_free(JTSQueryBatch *batch) {
+  for (int32_t i = 0; i < batch->count; i++) {
+    if (NULL != batch->trees) {
+      if (NULL != batch->trees[i]) {
+        ts_tree_delete(batch->trees[i]);
+      }
+    }
+    if (NULL != batch->results) {
+      free(batch->results[i].data);
+    }
+  }
+  free(batch->trees);
+  free(batch->sources);
+  free(batch->results);
+  free(batch->failed);
+}
+
+/**
+ * Run a compiled query over many trees on a pool of worker threads,
+ * each with its own query cursor.
+ *
+ * `sources` (optional, as for a query cursor's `:exec`) holds the source
+ * of each tree, needed if the query has text predicates.  Trees from
+ * `parse-file` default to their mapping.  `offsets` (optional) holds
+ * the byte offset of each tree's parsed text within its source, for
+ * trees parsed from slices via parse-bytes.  Returns an array with one
+ * buffer of packed capture records per tree, in the format of a query
+ * cursor's `:captures-into`.
+ */
+static Janet cfun_query_batch(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 6);
+
+  JTSQuery *query_p = jts_get_query(argv, 0);
+  JanetView trees = janet_getindexed(argv, 1);
+
+  JanetView sources = {NULL, 0};
+  if ((argc > 2) && !janet_checktype(argv[2], JANET_NIL)) {
+    sources = janet_getindexed(argv, 2);
+    if (sources.len != trees.len) {
+      janet_panicf("expected %d sources, got %d", trees.len, sources.len);
+    }
+  }
+
+  int32_t count = trees.len;
+  int32_t n_threads = jts_worker_count(argv, argc, 3, count);
+  int with_points = (argc > 4) && janet_truthy(argv[4]);
+
+  JanetView offsets = {NULL, 0};
+  if ((argc > 5) && !janet_checktype(argv[5], JANET_NIL)) {
+    offsets = janet_getindexed(argv, 5);
+    if (offsets.len != trees.len) {
+      janet_panicf("expected %d offsets, got %d", trees.len, offsets.len);
+    }
+  }
+
+  // validate everything before allocating
+  for (int32_t i = 0; i < count; i++) {
+    JTSTree *tree_p =
+      (JTSTree *)janet_checkabstract(trees.items[i], &jts_tree_type);
+    if (NULL == tree_p) {
+      janet_panicf("item %d: expected tree, got %v", i, trees.items[i]);
+    }
+    Janet source = (NULL != sources.items) ? sources.items[i] : tree_p->source;
+    if (janet_checktype(source, JANET_NIL)) {
+      if (query_p->predicate_count > 0) {
+        janet_panicf("item %d: source required for query with text "
+                     "predicates", i);
+      }
+    } else {
+      int32_t offset =
+        (NULL != offsets.items) ? janet_getnat(offsets.items, i) : 0;
+      (void)jts_source_from(jts_get_source(&source, 0), offset);
+    }
+  }
+
+  JTSQueryBatch batch;
+  batch.query = query_p;
+  batch.with_points = with_points;
+  batch.count = count;
+  batch.next = 0;
+  batch.trees = (TSTree **)calloc((size_t)count + 1, sizeof(TSTree *));
+  batch.sources =
+    (JanetByteView *)calloc((size_t)count + 1, sizeof(JanetByteView));
+  batch.results = (JTSBytes *)calloc((size_t)count + 1, sizeof(JTSBytes));
+  batch.failed = (uint8_t *)calloc((size_t)count + 1, 1);
+  if ((NULL == batch.trees) || (NULL == batch.sources) ||
+      (NULL == batch.results) || (NULL == batch.failed)) {
+    jts_query_batch_free(&batch);
+    janet_panic("failed to allocate batch");
+  }
+
+  for (int32_t i = 0; i < count; i++) {
+    JTSTree *tree_p = (JTSTree *)janet_unwrap_abstract(trees.items[i]);
+    Janet source = (NULL != sources.items) ? sources.items[i] : tree_p->source;
+    if (!janet_checktype(source, JANET_NIL)) {
+      int32_t offset =
+        (NULL != offsets.items) ? janet_getnat(offsets.items, i) : 0;
+      batch.sources[i] = jts_source_from(jts_get_source(&source, 0), offset);
+    }
+    // each worker gets its own copy, so a tree listed twice is never
+    // used by two threads at once
+    batch.trees[i] = ts_tree_copy(tree_p->tree);
+  }
+
+  // the janet values being read stay put as this thread is blocked until
+  // all workers are done
+  jts_run_workers(n_threads, jts_query_batch_worker, &batch);
+
+  for (int32_t i = 0; i < count; i++) {
+    if (batch.failed[i] || (batch.results[i].count > INT32_MAX)) {
+      jts_query_batch_free(&batch);
+      janet_panicf("item %d: failed to allocate query results", i);
+    }
+  }
+
+  JanetArray *results = janet_array(count);
+  for (int32_t i = 0; i < count; i++) {
+    int32_t len = (int32_t)batch.results[i].count;
+    JanetBuffer *buf = janet_buffer(len);
+    if (len > 0) {
+      janet_buffer_push_bytes(buf, batch.results[i].data, len);
+    }
+    janet_array_push(results, janet_wrap_buffer(buf));
+  }
+
+  jts_query_batch_free(&batch);
+
+  return janet_wrap_array(results);
+}
+
+////////
+
 static const JanetReg cfuns[] = {
   {
     "_init", cfun_ts_init,
@@ -1778,6 +7531,58 @@ static const JanetReg cfuns[] = {
     "`fn-name` is the grammar init function name as a string, e.g.\n"
     "`tree_sitter_clojure` or `tree_sitter_janet_simple`."
   },
+  {
+    "_language", cfun_ts_language,
+    "(_tree-sitter/_language path fn-name)\n\n"
+    "Return tree-sitter language for grammar.\n"
+    "`path` and `fn-name` are as for `_init`.  Each grammar is loaded\n"
+    "once per process and the resulting language is cached."
+  },
+  {
+    "_registry-stats", cfun_ts_registry_stats,
+    "(_tree-sitter/_registry-stats)\n\n"
+    "Return struct describing the grammar registry with keys\n"
+    "`:languages`, `:failures`, `:hits`, and `:misses`."
+  },
+  {
+    "_cancellation-flag", cfun_cancellation_flag_new,
+    "(_tree-sitter/_cancellation-flag)\n\n"
+    "Return new cancellation flag for use with a parser's\n"
+    "`:set-cancellation-flag`.\n"
+  },
+  {
+    "_parser-pool", cfun_parser_pool_new,
+    "(_tree-sitter/_parser-pool lang &opt capacity warm)\n\n"
+    "Return new pool of parsers for language `lang`, keeping at most\n"
+    "`capacity` idle parsers, `warm` of which are created up front.\n"
+  },
+  {
+    "_document", cfun_document_new,
+    "(_tree-sitter/_document parser src)\n\n"
+    "Return new document holding a copy of `src`, parsed with `parser`.\n"
+  },
+  {
+    "_parse-batch", cfun_parse_batch,
+    "(_tree-sitter/_parse-batch lang items &opt n-threads from-files)\n\n"
+    "Return array of trees from parsing `items` with `lang` on\n"
+    "`n-threads` worker threads (default: number of processors).\n"
+    "`items` are sources (strings or buffers), or, if `from-files` is\n"
+    "truthy, file paths.  Failed items yield nil.\n"
+  },
+  {
+    "_mapping", cfun_mapping_new,
+    "(_tree-sitter/_mapping path)\n\n"
+    "Return read-only memory mapping of the file at `path`, or nil.\n"
+    "Mappings can be given as the source to a node's `:text`.\n"
+  },
+  {
+    "_search-spec", cfun_search_spec_new,
+    "(_tree-sitter/_search-spec lang spec)\n\n"
+    "Return compiled node predicate for language `lang` from `spec`,\n"
+    "a struct or table with optional keys `:type`, `:field`, `:named`,\n"
+    "`:extra`, and `:text`.  Use with a node's `:search` or\n"
+    "`:search-all`.\n"
+  },
   {
     "_cursor", cfun_cursor_new,
     "(_tree-sitter/_cursor node)\n\n"
@@ -1785,8 +7590,35 @@ static const JanetReg cfuns[] = {
   },
   {
     "_query", cfun_query_new,
-    "(_tree-sitter/_query lang-name src)\n\n"
-    "Return new query for `lang-name` and `src`.\n"
+    "(_tree-sitter/_query lang src)\n\n"
+    "Return new query for language `lang` and `src`.\n"
+  },
+  {
+    "_query-cache-stats", cfun_query_cache_stats,
+    "(_tree-sitter/_query-cache-stats)\n\n"
+    "Return struct describing the compiled query cache with keys\n"
+    "`:entries`, `:capacity`, `:source-bytes` (total size of the cached\n"
+    "query sources), `:hits`, and `:misses`.\n"
+  },
+  {
+    "_query-cache-set-capacity", cfun_query_cache_set_capacity,
+    "(_tree-sitter/_query-cache-set-capacity n)\n\n"
+    "Set the maximum number of cached compiled queries, evicting the\n"
+    "least recently used beyond it.  0 disables caching.  Returns the\n"
+    "previous capacity.\n"
+  },
+  {
+    "_query-batch", cfun_query_batch,
+    "(_tree-sitter/_query-batch q trees &opt sources n-threads "
+    "with-points offsets)\n\n"
+    "Return array of buffers of packed capture records from running\n"
+    "query `q` over each of `trees` on `n-threads` worker threads\n"
+    "(default: number of processors).  `sources` holds each tree's\n"
+    "source, needed for text predicates; trees from `parse-file` use\n"
+    "their mapping by default.  `offsets` holds the byte offset of each\n"
+    "tree's parsed text within its source, for slices given to\n"
+    "`parse-bytes`.  Records are as for a query cursor's\n"
+    "`:captures-into`.\n"
   },
   {
     "_query-cursor", cfun_query_cursor_new,
@@ -1797,10 +7629,21 @@ static const JanetReg cfuns[] = {
 };
 
 JANET_MODULE_ENTRY(JanetTable *env) {
+  // runs once per vm, so tables cached for a previous vm on this thread
+  // are gone with its heap
+  jts_keyword_cache = NULL;
+  jts_field_cache = NULL;
+
   janet_register_abstract_type(&jts_language_type);
   janet_register_abstract_type(&jts_parser_type);
+  janet_register_abstract_type(&jts_parser_pool_type);
+  janet_register_abstract_type(&jts_cancellation_flag_type);
   janet_register_abstract_type(&jts_tree_type);
+  janet_register_abstract_type(&jts_mapping_type);
+  janet_register_abstract_type(&jts_search_spec_type);
   janet_register_abstract_type(&jts_node_type);
+  janet_register_abstract_type(&jts_node_table_type);
+  janet_register_abstract_type(&jts_document_type);
   janet_register_abstract_type(&jts_cursor_type);
   janet_register_abstract_type(&jts_query_type);
   janet_register_abstract_type(&jts_query_cursor_type);